@@ -0,0 +1,70 @@
+#include "dentry_cache.h"
+
+#include <algorithm>
+#include <gflags/gflags.h>
+#include <mutex>
+
+DEFINE_uint64(dentry_cache_size, 1 << 20,
+              "Number of names the client caches the inode of");
+DEFINE_int32(dentry_negative_ttl_ms, 1000,
+             "How long the client remembers that a name doesn't exist, 0 to "
+             "not remember it");
+
+DentryCache::DentryCache()
+    : shard_capacity_(std::max<uint64_t>(FLAGS_dentry_cache_size / kShards,
+                                         1)) {}
+
+bool DentryCache::lookup(uint64_t parent, const std::string &name,
+                         uint64_t *inode) {
+    Key key{parent, name};
+    Shard &s = shard(key);
+    std::shared_lock lk(s.mu);
+
+    auto it = s.entries.find(key);
+    if (it == s.entries.end()) {
+        return false;
+    }
+    if (it->second.inode == 0 && it->second.expiry < Clock::now()) {
+        return false; // Expired, the next insert replaces it
+    }
+    *inode = it->second.inode;
+    return true;
+}
+
+void DentryCache::insert(uint64_t parent, const std::string &name,
+                         uint64_t inode) {
+    put(Key{parent, name}, Entry{inode, Clock::time_point()});
+}
+
+void DentryCache::insert_negative(uint64_t parent, const std::string &name) {
+    if (FLAGS_dentry_negative_ttl_ms <= 0) {
+        return;
+    }
+    put(Key{parent, name},
+        Entry{0, Clock::now() +
+                     std::chrono::milliseconds(FLAGS_dentry_negative_ttl_ms)});
+}
+
+void DentryCache::erase(uint64_t parent, const std::string &name) {
+    Key key{parent, name};
+    Shard &s = shard(key);
+    std::unique_lock lk(s.mu);
+    s.entries.erase(key);
+}
+
+void DentryCache::put(Key key, Entry entry) {
+    Shard &s = shard(key);
+    std::unique_lock lk(s.mu);
+
+    auto it = s.entries.find(key);
+    if (it != s.entries.end()) {
+        it->second = entry;
+        return;
+    }
+    // Full: make room with whichever entry comes first, the cache is only
+    // there to skip work
+    if (s.entries.size() >= shard_capacity_) {
+        s.entries.erase(s.entries.begin());
+    }
+    s.entries.emplace(std::move(key), entry);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Maps (parent inode, name) to the inode of the entry, so that looking up
+// a hot name is one hash lookup instead of a walk through the directory.
+// Also remembers names that don't exist, for a short while since another
+// client may create them. Sharded so that lookups from many FUSE threads
+// don't contend on one lock.
+class DentryCache {
+  public:
+    DentryCache();
+
+    // Returns true if the cache knows about the name. *inode is then the
+    // inode of the entry, or 0 if it doesn't exist.
+    bool lookup(uint64_t parent, const std::string &name, uint64_t *inode);
+    void insert(uint64_t parent, const std::string &name, uint64_t inode);
+    void insert_negative(uint64_t parent, const std::string &name);
+    void erase(uint64_t parent, const std::string &name);
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Key {
+        uint64_t parent;
+        std::string name;
+        bool operator==(const Key &other) const {
+            return parent == other.parent && name == other.name;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<std::string>()(key.name) ^
+                   (key.parent * 0x9e3779b97f4a7c15ULL);
+        }
+    };
+    struct Entry {
+        uint64_t inode;           // 0 for a negative entry
+        Clock::time_point expiry; // Only for negative entries
+    };
+    struct Shard {
+        std::shared_mutex mu;
+        std::unordered_map<Key, Entry, KeyHash> entries;
+    };
+
+    static constexpr size_t kShards = 64;
+    std::array<Shard, kShards> shards_;
+    size_t shard_capacity_;
+
+    Shard &shard(const Key &key) { return shards_[KeyHash()(key) % kShards]; }
+    void put(Key key, Entry entry);
+};
@@ -25,23 +25,9 @@ Status Directory::init() {
             return s;
         }
         inode_ = attr.inode();
-    } else {
-        // Otherwise, fetch existing entries from metadata:
-        auto [s, dirent_list] = metadata_->readdir(inode_);
-        if (!s.ok()) {
-            return s;
-        }
-
-        // For each entry returned, insert into files_ or subdirs_ as appropriate.
-        for (const auto &dirent : dirent_list) {
-            // We need to acquire mu_ exclusively before mutating files_/subdirs_.
-            std::unique_lock lk(mu_);
-            Status s2 = _create_inode_unlocked(dirent.inode(), dirent.name());
-            if (!s2.ok()) {
-                return s2;
-            }
-        }
     }
+    // Entries of an existing directory are loaded as they are looked up or
+    // listed, see load()
     return Status::OK();
 }
 
@@ -85,6 +71,9 @@ Status Directory::destroy() {
 //
 
 std::shared_ptr<FileHandle> Directory::get_file(const std::string &name) {
+    if (!load(name).ok()) {
+        return nullptr;
+    }
     std::shared_lock lk(mu_);
     auto it = files_.find(name);
     if (it != files_.end()) {
@@ -94,6 +83,9 @@ std::shared_ptr<FileHandle> Directory::get_file(const std::string &name) {
 }
 
 Directory *Directory::get_dir(const std::string &name) {
+    if (!load(name).ok()) {
+        return nullptr;
+    }
     std::shared_lock lk(mu_);
     auto it = subdirs_.find(name);
     if (it != subdirs_.end()) {
@@ -109,12 +101,21 @@ Directory *Directory::get_dir(const std::string &name) {
 
 std::pair<Status, std::shared_ptr<FileHandle>>
 Directory::create_file(const std::string &name) {
+    // An entry that isn't loaded yet still takes the name
+    Status ls = load(name);
+    if (!ls.ok() && !ls.is_not_found()) {
+        return {ls, nullptr};
+    }
     std::unique_lock lk(mu_);
     return _create_file_unlocked(name);
 }
 
 std::pair<Status, Directory *>
 Directory::create_subdirectory(const std::string &name) {
+    Status ls = load(name);
+    if (!ls.ok() && !ls.is_not_found()) {
+        return {ls, nullptr};
+    }
     std::unique_lock lk(mu_);
     return _create_subdir_unlocked(name);
 }
@@ -249,6 +250,11 @@ Status Directory::move_file(Directory *parent_dir,
                             std::shared_ptr<FileHandle> fh,
                             const std::string &new_name)
 {
+    Status ls = load(new_name);
+    if (!ls.ok() && !ls.is_not_found()) {
+        return ls;
+    }
+
     // If parent_dir == this, do a “rename within same directory”
     if (parent_dir == this) {
         std::unique_lock lk(mu_);
@@ -296,13 +302,18 @@ Status Directory::move_file(Directory *parent_dir,
 }
 
 Status Directory::move_dir(Directory *parent_dir,
-                           std::unique_ptr<Directory> dir,
+                           Directory *dir,
                            const std::string &new_name)
 {
+    Status ls = load(new_name);
+    if (!ls.ok() && !ls.is_not_found()) {
+        return ls;
+    }
+
     // If parent_dir == this, “rename within the same directory” logic:
     if (parent_dir == this) {
         std::unique_lock lk(mu_);
-        return _move_dir_within_same_dir_unlocked(std::move(dir), new_name);
+        return _move_dir_within_same_dir_unlocked(dir, new_name);
     }
 
     // Otherwise, lock both directories’ mu_ in a fixed order:
@@ -362,34 +373,71 @@ Status Directory::getattr(struct stat *buf) {
     return Status::OK();
 }
 
-Status Directory::readdir(void *buf, fuse_fill_dir_t filler, fuse_readdir_flags /*flags*/) {
-    std::unique_lock lk(mu_);
-    auto [s, list] = metadata_->readdir(inode_);
+Status Directory::readdir(const std::string &start_after,
+                          uint32_t max_entries, bool load,
+                          std::vector<DirEntry> *entries, bool *more) {
+    auto [s, page] = metadata_->readdirplus(inode_, start_after, max_entries);
     if (!s.ok()) {
         return s;
     }
+    *more = page.more() && page.entries_size() > 0;
 
-    for (const auto &entry : list) {
-        if (!files_.count(entry.name()) && !subdirs_.count(entry.name())) {
+    std::unique_lock lk(mu_);
+    entries->reserve(entries->size() + page.entries_size());
+    for (const auto &d : page.entries()) {
+        const std::string &name = d.entry().name();
+        if (load && !files_.count(name) && !subdirs_.count(name)) {
             // We need to insert an in-memory entry first via create_inode:
-            Status s2 = _create_inode_unlocked(entry.inode(), entry.name());
+            Status s2 = _create_inode_unlocked(d.entry().inode(), name, d.attr());
             if (!s2.ok()) {
                 return s2;
             }
         }
 
-        struct stat st;
-        memset(&st, 0, sizeof(st));
-        st.st_ino  = entry.inode();
-        st.st_mode = S_IFREG | 0755;
-        if (filler(buf, entry.name().c_str(), &st, 0,
-                   static_cast<fuse_fill_dir_flags>(0))) {
-            break;
+        DirEntry entry{name, d.entry().inode(), 0, {}};
+        auto it = files_.find(name);
+        if (it != files_.end()) {
+            it->second->getattr(d.attr(), &entry.attr);
+        } else {
+            attr_to_stat(d.attr(), &entry.attr);
         }
+        entry.mode = entry.attr.st_mode & S_IFMT;
+        entries->push_back(std::move(entry));
     }
     return Status::OK();
 }
 
+bool Directory::empty() const {
+    // Not all entries may be loaded, so ask for the first one
+    auto [s, page] = metadata_->readdir(inode_, "", 1);
+    return s.ok() && page.entries_size() == 0;
+}
+
+bool Directory::has_loaded_entries() const {
+    std::shared_lock lk(mu_);
+    return !files_.empty() || !subdirs_.empty();
+}
+
+bool Directory::evict(const std::string &name, uint64_t inode) {
+    std::unique_lock lk(mu_);
+    if (auto it = files_.find(name); it != files_.end()) {
+        if (it->second->get_inode() != inode || !it->second->is_idle()) {
+            return false;
+        }
+        files_.erase(it);
+        return true;
+    }
+    if (auto it = subdirs_.find(name); it != subdirs_.end()) {
+        if (it->second->get_inode() != inode ||
+            it->second->has_loaded_entries()) {
+            return false;
+        }
+        subdirs_.erase(it);
+        return true;
+    }
+    return false;
+}
+
 Status Directory::utimens(const struct timespec tv[2]) {
     std::unique_lock lk(mu_);
     auto [s_attr, attr] = metadata_->getattr(inode_);
@@ -401,6 +449,33 @@ Status Directory::utimens(const struct timespec tv[2]) {
     return metadata_->setattr(attr);
 }
 
+std::pair<Status, ECProfile> Directory::get_ec_profile() {
+    std::shared_lock lk(mu_);
+    auto [s, attr] = metadata_->getattr(inode_);
+    if (!s.ok()) {
+        return {s, ECProfile()};
+    }
+    if (!attr.has_ec_profile()) {
+        return {Status::NotFound("Directory has no EC profile"), ECProfile()};
+    }
+    return {Status::OK(), attr.ec_profile()};
+}
+
+Status Directory::set_ec_profile(const ECProfile &profile) {
+    std::unique_lock lk(mu_);
+    Status s = StorageClient::validate_profile(profile);
+    if (!s.ok()) {
+        return s;
+    }
+    auto [s_attr, attr] = metadata_->getattr(inode_);
+    if (!s_attr.ok()) {
+        return s_attr;
+    }
+    // Only entries created from now on pick the new profile up
+    *attr.mutable_ec_profile() = profile;
+    return metadata_->setattr(attr);
+}
+
 std::vector<std::shared_ptr<FileHandle>> Directory::list_files() {
     std::shared_lock lk(mu_);
     std::vector<std::shared_ptr<FileHandle>> result;
@@ -425,7 +500,9 @@ std::vector<Directory *> Directory::list_dirs() {
 // === _create_inode_unlocked ===
 //
 
-Status Directory::_create_inode_unlocked(const uint64_t &inode, const std::string &name) {
+Status Directory::_create_inode_unlocked(const uint64_t &inode,
+                                         const std::string &name,
+                                         const Attributes &attr) {
     if (files_.count(name)) {
         return Status::AlreadyExists("File already exists");
     }
@@ -433,15 +510,10 @@ Status Directory::_create_inode_unlocked(const uint64_t &inode, const std::strin
         return Status::AlreadyExists("Directory already exists");
     }
 
-    auto [s_attr, attr] = metadata_->getattr(inode);
-    if (!s_attr.ok()) {
-        return s_attr;
-    }
-
-    if (attr.mode() & S_IFDIR) {
+    if (S_ISDIR(attr.mode())) {
         // Subdirectory case
         auto new_dir = std::make_unique<Directory>(
-            /*p_inode=*/ inode,
+            /*p_inode=*/ inode_,
             /*inode=*/ inode,
             join_paths(logic_path_, name),
             mount_path_,
@@ -458,7 +530,7 @@ Status Directory::_create_inode_unlocked(const uint64_t &inode, const std::strin
     } else {
         // File case
         auto new_file = std::make_shared<FileHandle>(
-            /*p_inode=*/ inode,
+            /*p_inode=*/ inode_,
             /*inode=*/ inode,
             join_paths(logic_path_, name),
             mount_path_,
@@ -475,6 +547,24 @@ Status Directory::_create_inode_unlocked(const uint64_t &inode, const std::strin
     return Status::OK();
 }
 
+Status Directory::load(const std::string &name) {
+    {
+        std::shared_lock lk(mu_);
+        if (files_.count(name) || subdirs_.count(name)) {
+            return Status::OK();
+        }
+    }
+
+    // The RPC runs unlocked, a concurrent load of the same name may win
+    auto [s, attr] = metadata_->lookup(inode_, name);
+    if (!s.ok()) {
+        return s;
+    }
+    std::unique_lock lk(mu_);
+    Status s2 = _create_inode_unlocked(attr.inode(), name, attr);
+    return s2.is_already_exists() ? Status::OK() : s2;
+}
+
 //
 // === _move within same directory (unlocked) ===
 //
@@ -507,13 +597,14 @@ Status Directory::_move_file_within_same_dir_unlocked(std::shared_ptr<FileHandle
     return Status::OK();
 }
 
-Status Directory::_move_dir_within_same_dir_unlocked(std::unique_ptr<Directory> dir,
+Status Directory::_move_dir_within_same_dir_unlocked(Directory *dir,
                                                      const std::string &new_name)
 {
     // (caller holds mu_)
 
     const std::string old_name = dir->get_name();
-    if (!subdirs_.count(old_name)) {
+    auto it = subdirs_.find(old_name);
+    if (it == subdirs_.end()) {
         return Status::NotFound("Directory not found in this directory");
     }
     if (subdirs_.count(new_name)) {
@@ -529,10 +620,10 @@ Status Directory::_move_dir_within_same_dir_unlocked(std::unique_ptr<Directory>
     if (!s.ok()) return s;
 
     // Update in-memory
-    subdirs_.erase(old_name);
-    dir->logic_path_ = join_paths(logic_path_, new_name);
-    dir->p_inode_    = inode_;
-    subdirs_.emplace(new_name, std::move(dir));
+    std::unique_ptr<Directory> moved = std::move(it->second);
+    subdirs_.erase(it);
+    moved->logic_path_ = join_paths(logic_path_, new_name);
+    subdirs_.emplace(new_name, std::move(moved));
     return Status::OK();
 }
 
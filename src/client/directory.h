@@ -6,7 +6,6 @@
 #include "file_handle.h"
 #include "status.h"
 #include "util.h"
-#include "fuse.h"
 
 #include <map>
 #include <memory>
@@ -15,6 +14,14 @@
 #include <vector>
 #include <sys/stat.h>   // for POSIX stat types
 
+// One entry of a directory listing
+struct DirEntry {
+    std::string name;
+    uint64_t inode;
+    mode_t mode;      // Only the file type bits
+    struct stat attr; // Attributes, if the listing came with them
+};
+
 class Directory {
   public:
     // Constructor: parent inode, this inode, logical path, mount path, RPC clients
@@ -30,6 +37,10 @@ class Directory {
 
     Status init();
     Status destroy();
+    // Loads the entry `name` from the metadata service, unless it already
+    // is, NotFound if there is none. get_file() and get_dir() go through
+    // it, so a directory only holds the entries that were used.
+    Status load(const std::string &name);
     std::shared_ptr<FileHandle> get_file(const std::string &name);
     Directory* get_dir(const std::string &name);
     std::pair<Status, std::shared_ptr<FileHandle>> create_file(const std::string &name);
@@ -37,14 +48,29 @@ class Directory {
     std::pair<Status, std::shared_ptr<FileHandle>> remove_file(const std::string &name, bool delete_fh = true);
     std::pair<Status, std::unique_ptr<Directory>> remove_dir(const std::string &name, bool delete_dir = true);
     Status move_file(Directory* parent_dir, std::shared_ptr<FileHandle> fh, const std::string &new_name);
-    Status move_dir(Directory* parent_dir, std::unique_ptr<Directory> dir, const std::string &new_name);
+    Status move_dir(Directory* parent_dir, Directory* dir, const std::string &new_name);
     Status getattr(struct stat* buf);
-    Status readdir(void *buf, fuse_fill_dir_t filler, fuse_readdir_flags flags);
+    // Appends a page of at most max_entries entries of the directory, the
+    // ones after the name start_after, with their attributes to `entries`.
+    // `more` tells whether entries follow. With load, the entries are also
+    // loaded, like get_file() and get_dir() do.
+    Status readdir(const std::string &start_after, uint32_t max_entries,
+                   bool load, std::vector<DirEntry> *entries, bool *more);
     Status utimens(const struct timespec tv[2]);
+    // EC profile new entries of this directory inherit
+    std::pair<Status, ECProfile> get_ec_profile();
+    Status set_ec_profile(const ECProfile &profile);
     std::vector<std::shared_ptr<FileHandle>> list_files();
     std::vector<Directory*> list_dirs();
 
     uint64_t get_inode() const { return inode_; }
+    uint64_t get_parent_inode() const { return p_inode_; }
+    bool empty() const;
+    bool has_loaded_entries() const;
+    // Unloads the entry `name`, if it is still inode, when nothing uses it:
+    // a file that isn't open or cached locally, or a directory with no
+    // entries loaded. It is loaded again the next time it's looked up.
+    bool evict(const std::string &name, uint64_t inode);
     std::string get_name() const { return filename(logic_path_); }
 
 
@@ -53,9 +79,10 @@ class Directory {
     std::pair<Status, Directory*> _create_subdir_unlocked(const std::string &name);
     std::pair<Status, std::shared_ptr<FileHandle>> _remove_file_unlocked(const std::string &name, bool delete_fh);
     std::pair<Status, std::unique_ptr<Directory>> _remove_dir_unlocked(const std::string &name, bool delete_dir);
-    Status _create_inode_unlocked(const uint64_t &inode, const std::string &name);
+    Status _create_inode_unlocked(const uint64_t &inode, const std::string &name,
+                                  const Attributes &attr);
     Status _move_file_within_same_dir_unlocked(std::shared_ptr<FileHandle> fh, const std::string &new_name);
-    Status _move_dir_within_same_dir_unlocked(std::unique_ptr<Directory> dir, const std::string &new_name);
+    Status _move_dir_within_same_dir_unlocked(Directory* dir, const std::string &new_name);
 
     mutable std::shared_mutex mu_;
 
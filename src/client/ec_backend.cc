@@ -0,0 +1,132 @@
+#include "ec_backend.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <utility>
+
+// Preference order, see ec_backend.h
+static const std::vector<std::pair<std::string, ec_backend_id_t>> kBackends = {
+    {"isa_l_rs_vand", EC_BACKEND_ISA_L_RS_VAND},
+    {"isa_l_rs_cauchy", EC_BACKEND_ISA_L_RS_CAUCHY},
+    {"jerasure_rs_vand", EC_BACKEND_JERASURE_RS_VAND},
+    {"jerasure_rs_cauchy", EC_BACKEND_JERASURE_RS_CAUCHY},
+    {"liberasurecode_rs_vand", EC_BACKEND_LIBERASURECODE_RS_VAND},
+};
+
+bool ECBackends::lookup(const std::string &name, ec_backend_id_t *id) {
+    for (const auto &backend : kBackends) {
+        if (backend.first == name) {
+            *id = backend.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ECBackends::is_available(const std::string &name) {
+    ec_backend_id_t id;
+    return lookup(name, &id) && liberasurecode_backend_available(id) == 1;
+}
+
+const std::string &ECBackends::preferred() {
+    // liberasurecode_rs_vand is built into liberasurecode itself, so there
+    // is always something to fall back to
+    static const std::string best = [] {
+        std::vector<std::string> names = available();
+        return names.empty() ? std::string("liberasurecode_rs_vand")
+                             : names.front();
+    }();
+    return best;
+}
+
+std::vector<std::string> ECBackends::available() {
+    std::vector<std::string> names;
+    for (const auto &backend : kBackends) {
+        if (liberasurecode_backend_available(backend.second) == 1) {
+            names.push_back(backend.first);
+        }
+    }
+    return names;
+}
+
+void ECBackends::self_test(int k, int m, uint64_t size) {
+    constexpr int kRounds = 4;
+
+    std::string data(size, '\0');
+    std::mt19937_64 rng(42);
+    for (auto &c : data) {
+        c = static_cast<char>(rng());
+    }
+
+    for (const auto &name : available()) {
+        ec_backend_id_t id;
+        lookup(name, &id);
+        struct ec_args args = {};
+        args.k = k;
+        args.m = m;
+        int desc = liberasurecode_instance_create(id, &args);
+        if (desc <= 0) {
+            std::cerr << "[WARN] EC self-test: can't create " << name
+                      << " instance" << std::endl;
+            continue;
+        }
+
+        char **data_frags = nullptr;
+        char **parity_frags = nullptr;
+        uint64_t frag_len = 0;
+        bool ok = true;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kRounds && ok; i++) {
+            if (data_frags || parity_frags) {
+                liberasurecode_encode_cleanup(desc, data_frags, parity_frags);
+            }
+            ok = liberasurecode_encode(desc, data.data(), data.size(),
+                                       &data_frags, &parity_frags,
+                                       &frag_len) == 0;
+        }
+        std::chrono::duration<double> encode_time =
+            std::chrono::steady_clock::now() - start;
+
+        // Decode without the first data fragment, so the test goes through
+        // the actual reconstruction
+        std::vector<char *> frags;
+        for (int i = 1; i < k && ok; i++) {
+            frags.push_back(data_frags[i]);
+        }
+        if (ok) {
+            frags.push_back(parity_frags[0]);
+        }
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kRounds && ok; i++) {
+            char *decoded = nullptr;
+            uint64_t decoded_len = 0;
+            ok = liberasurecode_decode(desc, frags.data(), k, frag_len, 0,
+                                       &decoded, &decoded_len) == 0 &&
+                 decoded_len == size;
+            if (decoded) {
+                liberasurecode_decode_cleanup(desc, decoded);
+            }
+        }
+        std::chrono::duration<double> decode_time =
+            std::chrono::steady_clock::now() - start;
+
+        if (data_frags || parity_frags) {
+            liberasurecode_encode_cleanup(desc, data_frags, parity_frags);
+        }
+        liberasurecode_instance_destroy(desc);
+
+        if (!ok) {
+            std::cerr << "[WARN] EC self-test: " << name << " failed"
+                      << std::endl;
+            continue;
+        }
+        double mb = static_cast<double>(size) * kRounds / (1024 * 1024);
+        std::cout << "[INFO] EC self-test " << name << " " << k << "+" << m
+                  << ": encode " << mb / encode_time.count() << " MiB/s, "
+                  << "decode " << mb / decode_time.count() << " MiB/s"
+                  << std::endl;
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <liberasurecode/erasurecode.h>
+#include <string>
+#include <vector>
+
+// The liberasurecode Reed-Solomon backends TorchFS can store files with, in
+// order of preference: the SIMD-accelerated ISA-L ones first, then
+// Jerasure, then the portable implementation bundled with liberasurecode.
+// All of them are systematic.
+class ECBackends {
+  public:
+    // Maps a backend name, as stored in an ECProfile, to its liberasurecode
+    // id. Returns false for names that are not in the list.
+    static bool lookup(const std::string &name, ec_backend_id_t *id);
+
+    // Whether the backend's library is installed on this host
+    static bool is_available(const std::string &name);
+
+    // Best available backend, probed once
+    static const std::string &preferred();
+
+    // Names of all available backends, best first
+    static std::vector<std::string> available();
+
+    // Encodes and decodes `size` bytes with every available backend as a
+    // k+m code and logs the throughput of each
+    static void self_test(int k, int m, uint64_t size);
+};
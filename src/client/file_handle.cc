@@ -1,6 +1,14 @@
+#include <algorithm>
+#include <atomic>
+#include <bthread/bthread.h>
+#include <bthread/countdown_event.h>
+#include <bthread/mutex.h>
 #include <cerrno>
 #include <cstring>
+#include <ctime>
 #include <fcntl.h>
+#include <gflags/gflags.h>
+#include <iostream>
 #include <memory>
 #include <shared_mutex>
 #include <string>
@@ -9,12 +17,74 @@
 #include <utility>
 #include <vector>
 
+#include "ec_backend.h"
 #include "file_handle.h"
 #include "metadata.pb.h"
 #include "slice.h"
 #include "status.h"
 #include "util.h"
 
+DEFINE_int32(stripe_window, 4,
+             "Number of stripes fetched or flushed concurrently per file");
+
+// Blocks shared by the bthreads of one for_each_block_windowed() call,
+// each of which takes the next block until none are left or one failed
+template <typename Fn> struct BlockWindow {
+    const std::vector<uint64_t> *blocks;
+    Fn *fn;
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    bthread::Mutex mu;
+    Status result;
+    bthread::CountdownEvent done;
+
+    BlockWindow(const std::vector<uint64_t> *blocks, Fn *fn, int workers)
+        : blocks(blocks), fn(fn), done(workers) {}
+
+    static void *run(void *arg) {
+        auto *window = static_cast<BlockWindow *>(arg);
+        while (!window->failed.load(std::memory_order_relaxed)) {
+            size_t i = window->next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= window->blocks->size()) {
+                break;
+            }
+            Status s = (*window->fn)((*window->blocks)[i]);
+            if (!s.ok()) {
+                std::lock_guard<bthread::Mutex> lock(window->mu);
+                window->result = s;
+                window->failed.store(true, std::memory_order_relaxed);
+            }
+        }
+        window->done.signal();
+        return nullptr;
+    }
+};
+
+// Runs fn over blocks, at most FLAGS_stripe_window at a time, so large
+// transfers keep several storage nodes busy while memory stays bounded by
+// window * stripe size. The blocks are handed to bthreads, which wait on
+// their RPCs without holding an OS thread each; the caller works too.
+template <typename Fn>
+static Status for_each_block_windowed(const std::vector<uint64_t> &blocks,
+                                      Fn fn) {
+    if (blocks.empty()) {
+        return Status::OK();
+    }
+    int workers = static_cast<int>(std::min<size_t>(
+        std::max(FLAGS_stripe_window, 1), blocks.size()));
+    BlockWindow<Fn> window(&blocks, &fn, workers);
+    for (int i = 1; i < workers; i++) {
+        bthread_t tid;
+        if (bthread_start_background(&tid, nullptr, &BlockWindow<Fn>::run,
+                                     &window) != 0) {
+            // One worker less, the others take its blocks
+            window.done.signal();
+        }
+    }
+    BlockWindow<Fn>::run(&window);
+    window.done.wait();
+    return window.result;
+}
 
 Status FileHandle::init() {
     if (inode_ == static_cast<uint64_t>(-1)) {
@@ -32,36 +102,47 @@ Status FileHandle::init() {
 Status FileHandle::destroy() {
     std::unique_lock lk(mu_);
 
+    Status ls = load_layout();
+    if (!ls.ok()) {
+        return ls;
+    }
+
+    uint64_t bs = stripe_size();
+    uint64_t size = attributes_.size();
+    uint64_t num_stripes = (size + bs - 1) / bs;
     if (fetched_) {
+        // A truncated file may still have stripes past its size
+        num_stripes = std::max(num_stripes, remote_stripes_);
         Status s = remove_local();
         if (!s.ok()) {
             return s;
         }
+    } else {
+        auto [s, attr] = metadata_->getattr(inode_);
+        if (!s.ok()) {
+            return s;
+        }
+        num_stripes = (attr.size() + bs - 1) / bs;
     }
 
-    auto s = metadata_->remove_file(p_inode_, inode_, filename(logic_path_));
+    std::vector<std::string> chunk_nodes, parity_nodes;
+    Status s = layout_nodes(&chunk_nodes, &parity_nodes);
     if (!s.ok()) {
         return s;
     }
 
-    std::vector<std::string> chunk_nodes{
-        "node1",
-        "node2",
-        "node3",
-        "node4",
-    };
-
-    std::vector<std::string> parity_nodes{
-        "node5",
-        "node6",
-    };
+    s = metadata_->remove_file(p_inode_, inode_, filename(logic_path_));
+    if (!s.ok()) {
+        return s;
+    }
 
-    storage_->remove_file(chunk_nodes, parity_nodes, std::to_string(inode_));
+    storage_->remove_file(chunk_nodes, parity_nodes, std::to_string(inode_),
+                          num_stripes);
 
     return Status::OK();
 }
 
-Status FileHandle::open(FilePointer **out_fp, int flags) {
+Status FileHandle::open(FilePointer **out_fp, int flags, bool *keep_cache) {
     std::unique_lock lk(mu_);
 
     if (!fetched_) {
@@ -71,6 +152,30 @@ Status FileHandle::open(FilePointer **out_fp, int flags) {
         }
     }
 
+    if (flags & O_TRUNC) {
+        // Truncate through the block map, otherwise blocks that are still
+        // missing locally would be fetched back on the next read.
+        if (::ftruncate(local_fd_, 0) == -1) {
+            return Status::IOError("Failed to truncate file: " +
+                                   std::string(strerror(errno)));
+        }
+        std::lock_guard blk(blocks_mu_);
+        present_.clear();
+        dirty_.clear();
+        fetching_.clear();
+        // remote_stripes_ is kept, flush removes the stripes
+        remote_size_ = 0;
+        attributes_.set_size(0);
+        written_ = true;
+        flags &= ~O_TRUNC;
+    }
+
+    if (keep_cache) {
+        *keep_cache = page_cache_valid();
+    }
+    page_cache_mtime_ = attributes_.modification_time();
+    page_cache_size_ = attributes_.size();
+
     std::string inode_str = std::to_string(inode_);
     std::string path      = join_paths(mount_path_, inode_str);
 
@@ -115,7 +220,10 @@ Status FileHandle::close(FilePointer *fp) {
 }
 
 Status FileHandle::read(FilePointer *fp, Slice &dst, size_t size, off_t offset) {
-    std::shared_lock lk(mu_);
+    Status s = prepare_read(size, offset);
+    if (!s.ok()) {
+        return s;
+    }
 
     ssize_t bytes_read = fp->read(dst, size, offset);
     if (bytes_read < 0) {
@@ -126,28 +234,76 @@ Status FileHandle::read(FilePointer *fp, Slice &dst, size_t size, off_t offset)
     return Status::OK();
 }
 
+Status FileHandle::prepare_read(size_t size, off_t offset) {
+    std::shared_lock lk(mu_);
+    return fetch_range(offset, size);
+}
+
 Status FileHandle::write(FilePointer *fp, Slice &src, size_t count, off_t offset) {
+    return write(fp, count, offset, [&](int fd) {
+        return ::pwrite(fd, src.data(), count, offset);
+    });
+}
+
+Status FileHandle::write(FilePointer *fp, size_t count, off_t offset,
+                         const std::function<ssize_t(int fd)> &copy) {
     std::unique_lock lk(mu_);
 
+    if (count == 0) {
+        return Status::OK();
+    }
+
+    // Blocks that this write only partially covers have to be present
+    // locally first, otherwise the untouched part would be lost on flush.
+    uint64_t bs = stripe_size();
+    uint64_t end = offset + count;
+    uint64_t first = offset / bs;
+    uint64_t last = (end - 1) / bs;
+    if (offset % bs != 0) {
+        Status s = fetch_range(first * bs, bs);
+        if (!s.ok()) {
+            return s;
+        }
+    }
+    if (end % bs != 0) {
+        Status s = fetch_range(last * bs, bs);
+        if (!s.ok()) {
+            return s;
+        }
+    }
+
     // Write the data to the local file
-    ssize_t written = fp->write(src, count, offset);
+    ssize_t written = fp->fd < 0 ? -1 : copy(fp->fd);
 
     if (written < 0 || static_cast<size_t>(written) != count) {
         return Status::IOError("Failed to write file: " +
                                std::string(strerror(errno)));
     }
 
-    // Update the file attributes in the metadata service
-    // read stats from local file
-    std::string inode_str = std::to_string(inode_);
-    std::string path = join_paths(mount_path_, inode_str);
-    struct stat st;
-    if (::fstat(fp->fd, &st) == -1) {
-        return Status::IOError("fstat failed: " + std::string(strerror(errno)));
+    {
+        std::lock_guard blk(blocks_mu_);
+        if (present_.size() <= last) {
+            present_.resize(last + 1, false);
+            dirty_.resize(last + 1, false);
+        }
+        for (uint64_t block = first; block <= last; block++) {
+            present_[block] = true;
+            dirty_[block] = true;
+        }
     }
 
-    attributes_.set_size(st.st_size);
+    // A write only ever extends the file, so no need to fstat it
+    if (end > attributes_.size()) {
+        attributes_.set_size(end);
+    }
+    attributes_.set_modification_time(time(nullptr));
     written_ = true;
+
+    // The write went through the kernel, which updated its cached pages
+    if (page_cache_mtime_ >= 0) {
+        page_cache_mtime_ = attributes_.modification_time();
+        page_cache_size_ = attributes_.size();
+    }
     
     return Status::OK();
 }
@@ -168,12 +324,19 @@ Status FileHandle::getattr(struct stat *buf) {
     return Status::OK();
 }
 
+void FileHandle::getattr(const Attributes &remote, struct stat *buf) {
+    std::shared_lock lk(mu_);
+    attr_to_stat(fetched_ ? attributes_ : remote, buf);
+}
+
 Status FileHandle::utimens(const struct timespec tv[2]) {
     std::unique_lock lk(mu_);
 
     if (fetched_) {
         attributes_.set_access_time(tv[0].tv_sec);
         attributes_.set_modification_time(tv[1].tv_sec);
+        // Goes to the metadata service with the next flush
+        written_ = true;
     } else {
         // Update the file attributes in the metadata service
         auto [s, attr] = metadata_->getattr(inode_);
@@ -202,14 +365,64 @@ Status FileHandle::lseek(FilePointer *fp, off_t offset, int whence, off_t *new_o
 }
 
 Status FileHandle::sync() {
-    // Sync the file to the local storage
-    std::string inode_str = std::to_string(inode_);
-    std::string path = join_paths(mount_path_, inode_str);
+    std::unique_lock lk(mu_);
 
-    if (::fsync(::open(path.c_str(), O_RDWR)) == -1) {
-        return Status::IOError("fsync failed: " + std::string(strerror(errno)));
+    // The local file is only a cache, the data is safe once it's in
+    // remote storage
+    if (!fetched_ || !written_) {
+        return Status::OK();
     }
-    return Status::OK();
+    return flush();
+}
+
+std::pair<Status, ECProfile> FileHandle::get_ec_profile() {
+    std::unique_lock lk(mu_);
+    Status s = load_layout();
+    if (!s.ok()) {
+        return {s, ECProfile()};
+    }
+    return {Status::OK(), layout_.ec_profile()};
+}
+
+Status FileHandle::set_ec_profile(const ECProfile &profile) {
+    std::unique_lock lk(mu_);
+
+    Status s = StorageClient::validate_profile(profile);
+    if (!s.ok()) {
+        return s;
+    }
+
+    auto [as, attr] = metadata_->getattr(inode_);
+    if (!as.ok()) {
+        return as;
+    }
+    // Existing stripes were encoded with the current profile
+    uint64_t size = fetched_ ? attributes_.size() : attr.size();
+    if (size > 0 || attr.size() > 0) {
+        return Status::InvalidArgument(
+            "Can't change the EC profile of a non-empty file");
+    }
+
+    *attr.mutable_ec_profile() = profile;
+    s = metadata_->setattr(attr);
+    if (!s.ok()) {
+        return s;
+    }
+
+    // The metadata service placed the file again for the new k+m, and
+    // filled in the stripe size if the profile had none
+    layout_.Clear();
+    s = load_layout();
+    if (s.ok() && fetched_) {
+        *attributes_.mutable_ec_profile() = layout_.ec_profile();
+    }
+    return s;
+}
+
+bool FileHandle::is_idle() const {
+    std::shared_lock lk(mu_);
+    return file_pointers_.empty() && !fetched_ && !cached_ && !written_ &&
+           !unlink_;
 }
 
 void FileHandle::cache() {
@@ -228,6 +441,12 @@ void FileHandle::cache() {
         }
     }
 
+    // Cached files are expected to be served locally, so pull every block
+    Status s = fetch_range(0, remote_size_);
+    if (!s.ok()) {
+        return;
+    }
+
     cached_ = true;
 };
 
@@ -250,60 +469,67 @@ void FileHandle::uncache() {
 
 
 Status FileHandle::flush() {
-    std::string inode_str = std::to_string(inode_);
-    std::string path = join_paths(mount_path_, inode_str);
-    int fd = ::open(path.c_str(), O_RDWR);
-    if (fd == -1) {
-        return Status::IOError("Failed to open file: " +
-                                std::string(strerror(errno)));
+    // A profile that leaves the backend open gets this host's best one. It
+    // is recorded with the first stripes written, since only that backend
+    // can decode them afterwards.
+    if (layout_.ec_profile().backend().empty() && attributes_.size() > 0) {
+        layout_.mutable_ec_profile()->set_backend(ECBackends::preferred());
+        *attributes_.mutable_ec_profile() = layout_.ec_profile();
     }
 
-    // Get the file size.
-    struct stat st;
-    if (::fstat(fd, &st) == -1) {
-        return Status::IOError("Failed to stat file: " +
-                               std::string(strerror(errno)));
-    }
-    size_t filesize = st.st_size;
+    uint64_t bs = stripe_size();
+    uint64_t size = attributes_.size();
+    uint64_t nblocks = (size + bs - 1) / bs;
 
-    // Allocate a buffer and read the file content.
-    std::string buffer;
-    buffer.resize(filesize);
-    ssize_t n = ::read(fd, &buffer[0], filesize);
-    if (n < 0 || static_cast<size_t>(n) != filesize) {
-        return Status::IOError("Failed to read whole file: " +
-                               std::string(strerror(errno)));
-    }
-
-    // Write the file data to the remote storage.
-    std::vector<std::string> chunk_nodes{
-        "node1",
-        "node2",
-        "node3",
-        "node4",
-    };
-    std::vector<std::string> parity_nodes{
-        "node5",
-        "node6",
-    };
+    std::lock_guard blk(blocks_mu_);
 
-    std::string file_id = std::to_string(inode_);
-    Data data;
-    data.set_payload(buffer);
-    data.set_len(filesize);
+    // Only dirty blocks are pushed. Blocks past the old remote size that
+    // were never written are holes and go out as zeros.
+    std::vector<uint64_t> to_push;
+    for (uint64_t block = 0; block < nblocks; block++) {
+        bool dirty = block < dirty_.size() && dirty_[block];
+        if (dirty || block * bs >= remote_size_) {
+            to_push.push_back(block);
+        }
+    }
 
-    auto [s, bytes_written] =
-        storage_->write(chunk_nodes, parity_nodes, file_id, data);
+    Status s = for_each_block_windowed(
+        to_push, [this, size](uint64_t block) { return push_block(block, size); });
     if (!s.ok()) {
         return s;
     }
+    for (uint64_t block : to_push) {
+        if (block < dirty_.size()) {
+            dirty_[block] = false;
+        }
+    }
+    remote_size_ = size;
 
     auto meta_s = metadata_->setattr(attributes_);
     if (!meta_s.ok()) {
-        return s;
+        return meta_s;
     }
 
-    ::close(fd);
+    // Stripes past the end of a truncated file go once the metadata no
+    // longer covers them. A failed removal is tried again on the next flush,
+    // or when the file is removed.
+    if (remote_stripes_ > nblocks) {
+        std::vector<std::string> chunk_nodes, parity_nodes;
+        Status rs = layout_nodes(&chunk_nodes, &parity_nodes);
+        if (rs.ok()) {
+            rs = storage_->remove_stripes(chunk_nodes, parity_nodes,
+                                          std::to_string(inode_), nblocks,
+                                          remote_stripes_);
+        }
+        if (rs.ok()) {
+            remote_stripes_ = nblocks;
+        } else {
+            std::cerr << "[WARN] Failed to remove truncated stripes of inode "
+                      << inode_ << ": " << rs.ToString() << std::endl;
+        }
+    } else {
+        remote_stripes_ = nblocks;
+    }
 
     written_ = false;
 
@@ -311,66 +537,235 @@ Status FileHandle::flush() {
 }
 
 Status FileHandle::fetch() {
+    Status ls = load_layout();
+    if (!ls.ok()) {
+        return ls;
+    }
+
     // get the cache attributes from the metadata service
     auto [s, attr] = metadata_->getattr(inode_);
     if (!s.ok()) {
         return s;
     }
     attributes_ = attr;
+    remote_size_ = attr.size();
 
     std::string inode_str = std::to_string(inode_);
     std::string path = join_paths(mount_path_, inode_str);
-    int fd = ::open(path.c_str(), O_RDWR | O_CREAT);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
     if (fd == -1) {
         return Status::IOError("Failed to open file: " +
                                 std::string(strerror(errno)));
     }
 
-    if (attributes_.size() > 0) {
-        // Only fetch the file if it has a size greater than 0
-
-        // Retrieve the file from remote storage
-        std::vector<std::string> chunk_nodes{
-            "node1",
-            "node2",
-            "node3",
-            "node4",
-        };
-
-        std::vector<std::string> parity_nodes{
-            "node5",
-            "node6",
-        };
-
-        std::string file_id = std::to_string(inode_);
-        auto [st, data] = storage_->read(chunk_nodes, parity_nodes, file_id);
-        ssize_t written = ::write(fd, data.payload().c_str(), data.len());
-        if (written < 0 || static_cast<size_t>(written) != data.len()) {
-            return Status::IOError(
-                "Failed to write remote data to local file: " +
-                std::string(strerror(errno)));
+    // Size the local file up front and leave it sparse; blocks are pulled
+    // from remote storage the first time they are read.
+    if (::ftruncate(fd, remote_size_) == -1) {
+        ::close(fd);
+        return Status::IOError("Failed to size local file: " +
+                               std::string(strerror(errno)));
+    }
+    local_fd_ = fd;
+
+    uint64_t bs = stripe_size();
+    uint64_t nblocks = (remote_size_ + bs - 1) / bs;
+    {
+        std::lock_guard blk(blocks_mu_);
+        present_.assign(nblocks, false);
+        dirty_.assign(nblocks, false);
+        fetching_.assign(nblocks, false);
+        remote_stripes_ = nblocks;
+    }
+
+    fetched_ = true;
+
+    return Status::OK();
+}
+
+Status FileHandle::fetch_range(uint64_t offset, uint64_t size) {
+    std::unique_lock blk(blocks_mu_);
+
+    if (size == 0 || offset >= remote_size_) {
+        return Status::OK(); // Nothing in remote storage for this range
+    }
+
+    uint64_t bs = stripe_size();
+    uint64_t end = std::min(offset + size, remote_size_);
+    uint64_t first = offset / bs;
+    uint64_t last = (end - 1) / bs;
+    if (present_.size() <= last) {
+        present_.resize(last + 1, false);
+        dirty_.resize(last + 1, false);
+    }
+    fetching_.resize(present_.size(), false);
+
+    // Blocks another reader is fetching are waited for rather than fetched
+    // twice; if that fetch failed, they are picked up on the next round.
+    for (;;) {
+        std::vector<uint64_t> missing;
+        bool others = false;
+        for (uint64_t block = first; block <= last; block++) {
+            if (present_[block]) {
+                continue;
+            }
+            if (fetching_[block]) {
+                others = true;
+            } else {
+                fetching_[block] = true;
+                missing.push_back(block);
+            }
+        }
+
+        if (!missing.empty()) {
+            // The fetch runs unlocked so that other readers of the file get
+            // to blocks that are present or fetched by someone else
+            blk.unlock();
+            Status s = for_each_block_windowed(
+                missing, [this](uint64_t block) { return fetch_block(block); });
+            blk.lock();
+            for (uint64_t block : missing) {
+                fetching_[block] = false;
+                if (s.ok()) {
+                    present_[block] = true;
+                }
+            }
+            blocks_cv_.notify_all();
+            if (!s.ok()) {
+                return s;
+            }
+        } else if (others) {
+            blocks_cv_.wait(blk);
+        } else {
+            return Status::OK();
         }
     }
+}
 
-    ::close(fd); // Close the file descriptor after writing
+Status FileHandle::fetch_block(uint64_t block) {
+    std::vector<std::string> chunk_nodes, parity_nodes;
+    Status ls = layout_nodes(&chunk_nodes, &parity_nodes);
+    if (!ls.ok()) {
+        return ls;
+    }
 
+    std::unique_ptr<char[]> buf(new char[stripe_size()]);
+    auto [s, len] = storage_->read(layout_.ec_profile(), chunk_nodes,
+                                   parity_nodes, std::to_string(inode_), block,
+                                   buf.get());
+    if (!s.ok()) {
+        return s;
+    }
 
-    fetched_ = true;
+    off_t offset = block * stripe_size();
+    ssize_t written = ::pwrite(local_fd_, buf.get(), len, offset);
+    if (written < 0 || static_cast<uint64_t>(written) != len) {
+        return Status::IOError("Failed to write remote data to local file: " +
+                               std::string(strerror(errno)));
+    }
 
     return Status::OK();
 }
 
+Status FileHandle::push_block(uint64_t block, uint64_t size) {
+    std::vector<std::string> chunk_nodes, parity_nodes;
+    Status ls = layout_nodes(&chunk_nodes, &parity_nodes);
+    if (!ls.ok()) {
+        return ls;
+    }
+
+    uint64_t bs = stripe_size();
+    uint64_t offset = block * bs;
+    uint64_t len = std::min(bs, size - offset);
+
+    std::string buffer;
+    buffer.resize(len);
+    ssize_t n = ::pread(local_fd_, &buffer[0], len, offset);
+    if (n < 0 || static_cast<uint64_t>(n) != len) {
+        return Status::IOError("Failed to read block: " +
+                               std::string(strerror(errno)));
+    }
+
+    Data data;
+    data.set_payload(buffer);
+    data.set_len(len);
+
+    auto [s, bytes_written] =
+        storage_->write(layout_.ec_profile(), chunk_nodes, parity_nodes,
+                        std::to_string(inode_), block, data);
+    return s;
+}
+
+Status FileHandle::load_layout() {
+    if (layout_.has_ec_profile()) {
+        return Status::OK();
+    }
+    auto [s, info] = metadata_->open(inode_);
+    if (!s.ok()) {
+        return s;
+    }
+    if (!info.has_ec_profile()) {
+        // Files created before profiles existed were all written as 4+2
+        info.mutable_ec_profile()->set_k(4);
+        info.mutable_ec_profile()->set_m(2);
+        info.mutable_ec_profile()->set_backend("liberasurecode_rs_vand");
+    }
+    layout_ = info;
+    return Status::OK();
+}
+
+Status FileHandle::layout_nodes(std::vector<std::string> *data_nodes,
+                                std::vector<std::string> *parity_nodes) const {
+    // Placement is chosen by the metadata service when the file is created
+    if (layout_.chunk_nodes_size() !=
+            static_cast<int>(layout_.ec_profile().k()) ||
+        layout_.parity_nodes_size() !=
+            static_cast<int>(layout_.ec_profile().m())) {
+        return Status::IOError("Placement of inode " + std::to_string(inode_) +
+                               " doesn't match its EC profile");
+    }
+    data_nodes->assign(layout_.chunk_nodes().begin(),
+                       layout_.chunk_nodes().end());
+    parity_nodes->assign(layout_.parity_nodes().begin(),
+                         layout_.parity_nodes().end());
+    return Status::OK();
+}
+
+uint64_t FileHandle::stripe_size() const {
+    return storage_->stripe_size(layout_.ec_profile());
+}
+
 Status FileHandle::remove_local() {
+    if (local_fd_ >= 0) {
+        ::close(local_fd_);
+        local_fd_ = -1;
+    }
+
     std::string inode_str = std::to_string(inode_);
     std::string path = join_paths(mount_path_, inode_str);
     if (::unlink(path.c_str()) == -1) {
         return Status::IOError("Failed to unlink file: " +
                                std::string(strerror(errno)));
     }
+
+    std::lock_guard blk(blocks_mu_);
+    present_.clear();
+    dirty_.clear();
+    fetching_.clear();
     fetched_ = false;
     return Status::OK();
 }
 
+// Like FUSE's auto_cache: the kernel may keep the pages it cached while the
+// file was open before, as long as the file has the same modification time
+// and size as then. A change made by another client is noticed as soon as
+// this one fetches the attributes again.
+bool FileHandle::page_cache_valid() const {
+    return page_cache_mtime_ >= 0 &&
+           page_cache_mtime_ ==
+               static_cast<int64_t>(attributes_.modification_time()) &&
+           page_cache_size_ == attributes_.size();
+}
+
 void FileHandle::stat_to_attr(const struct stat &st, Attributes &a) {
     a.set_inode(inode_);
     a.set_path(logic_path_);
@@ -392,4 +787,5 @@ void FileHandle::attr_to_stat(const Attributes &a, struct stat *st) {
     st->st_ctime = a.creation_time();
     st->st_uid  = a.user_id();
     st->st_gid  = a.group_id();
+    st->st_ino  = a.inode();
 }
\ No newline at end of file
@@ -7,11 +7,15 @@
 #include "status.h"
 #include "storage_client.h"
 #include "util.h"
+#include <condition_variable>
 #include <fcntl.h>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <sys/stat.h>
 #include <shared_mutex>
+#include <vector>
 
 struct FilePointer;
 
@@ -24,31 +28,51 @@ class FileHandle : public std::enable_shared_from_this<FileHandle> {
                std::shared_ptr<StorageClient> storage)
         : p_inode_(p_inode), inode_(inode), logic_path_(logic_path),
           mount_path_(mount_path), metadata_(metadata), storage_(storage),
-          file_pointers_(), unlink_(false), cached_(false), fetched_(false), written_(false) {}
+          file_pointers_(), remote_size_(0), local_fd_(-1), unlink_(false),
+          cached_(false), fetched_(false), written_(false) {}
 
     ~FileHandle() {}
 
     Status init();
     Status destroy();
     // Status open(int flags);
-    Status open(FilePointer **fp, int flags); 
+    // keep_cache, when given, tells whether the pages the kernel cached
+    // from an earlier open are still valid, see page_cache_valid()
+    Status open(FilePointer **fp, int flags, bool *keep_cache = nullptr);
     Status close(FilePointer *fp);
     Status read(FilePointer *fp, Slice &dst, size_t size, off_t offset);
     Status write(FilePointer *fp, Slice &src, size_t count, off_t offset);
+    // Makes the range present in the local cache file, so that it can be
+    // read straight from the descriptor of a FilePointer
+    Status prepare_read(size_t size, off_t offset);
+    // Like write(), but copy moves the data into the descriptor at offset
+    // and returns how many bytes it wrote
+    Status write(FilePointer *fp, size_t count, off_t offset,
+                 const std::function<ssize_t(int fd)> &copy);
     Status getattr(struct stat *buf);
+    // Like getattr(), with `remote` as the attributes the metadata service
+    // has for the file. Local changes not flushed yet take precedence.
+    void getattr(const Attributes &remote, struct stat *buf);
     Status utimens(const struct timespec tv[2]);
     Status lseek(FilePointer *fp, off_t offset, int whence, off_t *new_offset);
+    // Pushes local changes to remote storage and the metadata service
     Status sync();
+    // EC profile of the file; it can only be changed while the file is empty
+    std::pair<Status, ECProfile> get_ec_profile();
+    Status set_ec_profile(const ECProfile &profile);
 
     std::string get_logic_path() { return logic_path_; }
     std::string get_name() { return filename(logic_path_); }
     uint64_t get_inode() { return inode_; }
+    uint64_t get_parent_inode() { return p_inode_; }
     void set_logic_path(const std::string &logic_path) {
         logic_path_ = logic_path;
     }
     void set_parent_inode(const uint64_t &p_inode) { p_inode_ = p_inode; }
     bool is_unlinked() const { return unlink_ && file_pointers_.empty(); }
     bool is_cached() const { return cached_; }
+    // Not open, and with no local state that would be lost by dropping it
+    bool is_idle() const;
 
     void unlink() {unlink_ = true;};
 
@@ -67,15 +91,45 @@ class FileHandle : public std::enable_shared_from_this<FileHandle> {
     std::shared_ptr<StorageClient> storage_;   // Storage client
     std::vector<std::unique_ptr<FilePointer>> file_pointers_; // File pointers
     Attributes attributes_;
+    FileInfo layout_; // EC profile the file is stored with, see load_layout()
+
+    // Block presence/dirtiness of the local cache file, one bit per block.
+    // A block is one stripe unit of the remote object. Guarded by blocks_mu_
+    // so that readers holding mu_ shared can still fill in missing blocks.
+    // The lock is not held while fetching: fetching_ marks the blocks a
+    // reader is getting, and blocks_cv_ wakes the readers waiting for them.
+    std::mutex blocks_mu_;
+    std::condition_variable blocks_cv_;
+    std::vector<bool> present_;
+    std::vector<bool> dirty_;
+    std::vector<bool> fetching_;
+    uint64_t remote_size_; // Size of the object in remote storage
+    // Stripes that may exist in remote storage. After a truncate this is
+    // more than remote_size_ covers, until flush removes the extra ones.
+    uint64_t remote_stripes_ = 0;
+    int local_fd_;         // Local cache file, used to fill and flush blocks
     bool unlink_;
     bool cached_;
     bool fetched_;
     bool written_;
 
+    // Version (mtime, size) of the file the kernel page cache holds since
+    // the last open, -1 before the first one
+    int64_t page_cache_mtime_ = -1;
+    uint64_t page_cache_size_ = 0;
+
     Status setattr(Attributes &attr);
+    Status load_layout();
+    Status layout_nodes(std::vector<std::string> *data_nodes,
+                        std::vector<std::string> *parity_nodes) const;
+    uint64_t stripe_size() const;
     Status flush();
     Status fetch();
+    Status fetch_range(uint64_t offset, uint64_t size);
+    Status fetch_block(uint64_t block);
+    Status push_block(uint64_t block, uint64_t size);
     Status remove_local();
+    bool page_cache_valid() const;
 
     void stat_to_attr(const struct stat &st, Attributes &a);
     void attr_to_stat(const Attributes &a, struct stat *st);
@@ -1,8 +1,19 @@
 #include "storage_engine.h"
 #include "torch_fuse.h"
 #include <gflags/gflags.h>
+#include <string>
 
 DEFINE_string(cache_dir, "", "Directory for local storage");
+DEFINE_bool(clone_fd, true,
+            "Give each FUSE worker thread its own /dev/fuse descriptor");
+DEFINE_uint32(max_threads, 64,
+              "Maximum number of FUSE worker threads, needs FUSE 3.12");
+DEFINE_int32(max_idle_threads, 16,
+             "Number of idle FUSE worker threads kept around, -1 for no "
+             "limit");
+DEFINE_uint32(max_read, 1024 * 1024,
+              "Maximum size of a read request in bytes, 0 for the kernel's "
+              "default");
 
 int main(int argc, char *argv[]) {
     enum { MAX_ARGS = 10 };
@@ -20,6 +31,36 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    struct fuse_args args = FUSE_ARGS_INIT(new_argc, new_argv);
+    struct fuse_cmdline_opts opts;
+    if (fuse_parse_cmdline(&args, &opts) != 0) {
+        return 1;
+    }
+    if (opts.show_help) {
+        printf("usage: %s [options] <mountpoint>\n\n", argv[0]);
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        free(opts.mountpoint);
+        fuse_opt_free_args(&args);
+        return 0;
+    } else if (opts.show_version) {
+        fuse_lowlevel_version();
+        free(opts.mountpoint);
+        fuse_opt_free_args(&args);
+        return 0;
+    }
+    if (opts.mountpoint == NULL) {
+        std::cerr << "usage: " << argv[0] << " [options] <mountpoint>"
+                  << std::endl;
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
+    if (FLAGS_max_read > 0) {
+        std::string max_read = "-omax_read=" + std::to_string(FLAGS_max_read);
+        fuse_opt_add_arg(&args, max_read.c_str());
+    }
+
     StorageEngine *se = new StorageEngine(FLAGS_cache_dir);
     Status s = se->init();
     if (!s.ok()) {
@@ -28,8 +69,52 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    fuse_main(new_argc, new_argv, &torch_oper, se);
+    int ret = 1;
+    struct fuse_session *session =
+        fuse_session_new(&args, &torch_oper, sizeof(torch_oper), se);
+    if (session == NULL) {
+        goto out_engine;
+    }
+    if (fuse_set_signal_handlers(session) != 0) {
+        goto out_session;
+    }
+    if (fuse_session_mount(session, opts.mountpoint) != 0) {
+        goto out_signals;
+    }
+
+    fuse_daemonize(opts.foreground);
+
+    // Like fuse_main did, serve requests from several threads unless -s
+    if (opts.singlethread) {
+        ret = fuse_session_loop(session);
+    } else {
+        // With its own descriptor per thread, workers don't all wait on the
+        // one /dev/fuse channel
+        bool clone_fd = FLAGS_clone_fd || opts.clone_fd;
+#if FUSE_USE_VERSION >= 312
+        struct fuse_loop_config *config = fuse_loop_cfg_create();
+        fuse_loop_cfg_set_clone_fd(config, clone_fd);
+        fuse_loop_cfg_set_max_threads(config, FLAGS_max_threads);
+        fuse_loop_cfg_set_idle_threads(config, FLAGS_max_idle_threads);
+        ret = fuse_session_loop_mt(session, config);
+        fuse_loop_cfg_destroy(config);
+#else
+        // Older FUSE only bounds the number of idle threads
+        struct fuse_loop_config config;
+        config.clone_fd = clone_fd;
+        config.max_idle_threads = FLAGS_max_idle_threads;
+        ret = fuse_session_loop_mt(session, &config);
+#endif
+    }
 
+    fuse_session_unmount(session);
+out_signals:
+    fuse_remove_signal_handlers(session);
+out_session:
+    fuse_session_destroy(session);
+out_engine:
     delete se;
-    return 0;
-}
\ No newline at end of file
+    free(opts.mountpoint);
+    fuse_opt_free_args(&args);
+    return ret ? 1 : 0;
+}
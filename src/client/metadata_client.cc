@@ -6,7 +6,10 @@
 #include <brpc/channel.h>
 #include <brpc/controller.h>
 #include <butil/logging.h>
+#include <cerrno>
+#include <gflags/gflags.h>
 #include <google/protobuf/empty.pb.h>
+#include <mutex>
 #include <stdexcept>
 #include <unistd.h> // usleep
 
@@ -22,12 +25,24 @@ static constexpr int kMaxRetries = 5;          // retry attempts
 static constexpr int kRetryBackoffUs = 100000; // 100 ms
 // ────────────────────────────────────────────────────────────────────────────────
 
+DEFINE_bool(metadata_follower_reads, true,
+            "Send metadata reads to all metadata peers instead of only to "
+            "the leader");
+
 MetadataClient::MetadataClient(const std::string & /*server_addr*/) {
     // Tell RouteTable about our group once:
     if (braft::rtb::update_configuration(kMetadataGroup, kMetadataConf) != 0) {
         throw std::runtime_error("Failed to register " + kMetadataConf +
                                  " for group " + kMetadataGroup);
     }
+    braft::Configuration conf;
+    if (conf.parse_from(kMetadataConf) == 0) {
+        std::vector<braft::PeerId> peers;
+        conf.list_peers(&peers);
+        for (const auto &peer : peers) {
+            peers_.push_back(peer.addr);
+        }
+    }
 }
 
 // Helper to pick or refresh the leader
@@ -44,116 +59,142 @@ static bool pick_leader(braft::PeerId *leader) {
     return (braft::rtb::select_leader(kMetadataGroup, leader) == 0);
 }
 
-std::pair<Status, Attributes> MetadataClient::getattr(const uint64_t &inode) {
-    InodeRequest req;
-    req.set_inode(inode);
-    Attributes resp;
+std::shared_ptr<brpc::Channel>
+MetadataClient::channel(const butil::EndPoint &addr) {
+    std::string key = butil::endpoint2str(addr).c_str();
+    std::lock_guard lk(channels_mu_);
+    auto it = channels_.find(key);
+    if (it != channels_.end()) {
+        return it->second;
+    }
+    auto channel = std::make_shared<brpc::Channel>();
+    if (channel->Init(addr, nullptr) != 0) {
+        return nullptr;
+    }
+    channels_.emplace(key, channel);
+    return channel;
+}
 
+template <typename Request, typename Response>
+Status MetadataClient::call(const char *name, Method<Request, Response> method,
+                            const Request &req, Response *resp) {
     for (int tries = 0; tries < kMaxRetries; ++tries) {
         braft::PeerId leader;
         if (!pick_leader(&leader)) {
             usleep(kRetryBackoffUs);
             continue;
         }
-        brpc::Channel channel;
-        brpc::Controller cntl;
-        cntl.set_timeout_ms(kTimeoutMs);
-
-        if (channel.Init(leader.addr, nullptr) != 0) {
+        auto ch = channel(leader.addr);
+        if (!ch) {
             braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
             usleep(kRetryBackoffUs);
             continue;
         }
-        MetadataService_Stub stub(&channel);
-        stub.getattr(&cntl, &req, &resp, nullptr);
+        brpc::Controller cntl;
+        cntl.set_timeout_ms(kTimeoutMs);
+        MetadataService_Stub stub(ch.get());
+        resp->Clear();
+        (stub.*method)(&cntl, &req, resp, nullptr);
 
+        if (cntl.ErrorCode() == ENOENT) {
+            return Status::NotFound(std::string(name) + "(): " +
+                                    cntl.ErrorText());
+        }
         if (cntl.Failed()) {
             // on transport error or NOT_LEADER redirect
-            LOG(WARNING) << "getattr() to " << leader
+            LOG(WARNING) << name << "() to " << leader
                          << " failed: " << cntl.ErrorText();
             braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
             usleep(kRetryBackoffUs);
             continue;
         }
-        // success
-        return {Status::OK(), resp};
+        return Status::OK();
     }
-    return {Status::IOError("getattr() failed after retries"), Attributes()};
+    return Status::IOError(std::string(name) + "() failed after retries");
 }
 
-std::pair<Status, std::vector<Dirent>>
-MetadataClient::readdir(const uint64_t &inode) {
-    ReadDirRequest req;
-    req.set_inode(inode);
-    ReadDirResponse resp;
-    std::vector<Dirent> out;
-
-    for (int tries = 0; tries < kMaxRetries; ++tries) {
-        braft::PeerId leader;
-        if (!pick_leader(&leader)) {
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        brpc::Channel channel;
+template <typename Request, typename Response>
+Status MetadataClient::call_read(const char *name,
+                                 Method<Request, Response> method,
+                                 const Request &req, Response *resp) {
+    if (!FLAGS_metadata_follower_reads || peers_.size() < 2) {
+        return call(name, method, req, resp);
+    }
+    const butil::EndPoint &peer =
+        peers_[next_peer_.fetch_add(1, std::memory_order_relaxed) %
+               peers_.size()];
+    if (auto ch = channel(peer)) {
         brpc::Controller cntl;
         cntl.set_timeout_ms(kTimeoutMs);
-
-        if (channel.Init(leader.addr, nullptr) != 0) {
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
+        MetadataService_Stub stub(ch.get());
+        (stub.*method)(&cntl, &req, resp, nullptr);
+        if (cntl.ErrorCode() == ENOENT) {
+            return Status::NotFound(std::string(name) + "(): " +
+                                    cntl.ErrorText());
         }
-        MetadataService_Stub stub(&channel);
-        stub.readdir(&cntl, &req, &resp, nullptr);
-
-        if (cntl.Failed()) {
-            LOG(WARNING) << "readdir() to " << leader
-                         << " failed: " << cntl.ErrorText();
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
+        if (!cntl.Failed()) {
+            return Status::OK();
         }
-        for (const auto &d : resp.entries()) {
-            out.push_back(d);
-        }
-        return {Status::OK(), out};
+        LOG(WARNING) << name << "() to " << peer
+                     << " failed: " << cntl.ErrorText();
     }
-    return {Status::IOError("readdir() failed after retries"), {}};
+    return call(name, method, req, resp);
 }
 
-std::pair<Status, FileInfo> MetadataClient::open(const uint64_t &inode) {
+std::pair<Status, Attributes> MetadataClient::getattr(const uint64_t &inode) {
     InodeRequest req;
     req.set_inode(inode);
-    FileInfo resp;
+    Attributes resp;
+    Status s =
+        call_read("getattr", &MetadataService_Stub::getattr, req, &resp);
+    return {s, resp};
+}
 
-    for (int tries = 0; tries < kMaxRetries; ++tries) {
-        braft::PeerId leader;
-        if (!pick_leader(&leader)) {
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        brpc::Channel channel;
-        brpc::Controller cntl;
-        cntl.set_timeout_ms(kTimeoutMs);
+std::pair<Status, Attributes>
+MetadataClient::lookup(const uint64_t &p_inode, const std::string &name) {
+    LookupRequest req;
+    req.set_p_inode(p_inode);
+    req.set_name(name);
+    Attributes resp;
+    Status s =
+        call_read("lookup", &MetadataService_Stub::lookup, req, &resp);
+    return {s, resp};
+}
 
-        if (channel.Init(leader.addr, nullptr) != 0) {
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        MetadataService_Stub stub(&channel);
-        stub.open(&cntl, &req, &resp, nullptr);
+std::pair<Status, ReadDirResponse>
+MetadataClient::readdir(const uint64_t &inode, const std::string &start_after,
+                        uint32_t max_entries) {
+    ReadDirRequest req;
+    req.set_inode(inode);
+    req.set_start_after(start_after);
+    req.set_max_entries(max_entries);
+    ReadDirResponse resp;
+    Status s =
+        call_read("readdir", &MetadataService_Stub::readdir, req, &resp);
+    return {s, std::move(resp)};
+}
 
-        if (cntl.Failed()) {
-            LOG(WARNING) << "open() to " << leader
-                         << " failed: " << cntl.ErrorText();
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        return {Status::OK(), resp};
-    }
-    return {Status::IOError("open() failed after retries"), FileInfo()};
+std::pair<Status, ReadDirPlusResponse>
+MetadataClient::readdirplus(const uint64_t &inode,
+                            const std::string &start_after,
+                            uint32_t max_entries) {
+    ReadDirPlusRequest req;
+    req.set_inode(inode);
+    req.set_start_after(start_after);
+    req.set_max_entries(max_entries);
+    ReadDirPlusResponse resp;
+    Status s = call_read("readdirplus", &MetadataService_Stub::readdirplus,
+                         req, &resp);
+    return {s, std::move(resp)};
+}
+
+std::pair<Status, FileInfo> MetadataClient::open(const uint64_t &inode) {
+    InodeRequest req;
+    req.set_inode(inode);
+    FileInfo resp;
+    Status s =
+        call_read("open", &MetadataService_Stub::open, req, &resp);
+    return {s, resp};
 }
 
 std::pair<Status, Attributes>
@@ -162,36 +203,9 @@ MetadataClient::create_file(const uint64_t &p_inode, const std::string &name) {
     req.set_p_inode(p_inode);
     req.set_name(name);
     Attributes resp;
-
-    for (int tries = 0; tries < kMaxRetries; ++tries) {
-        braft::PeerId leader;
-        if (!pick_leader(&leader)) {
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        brpc::Channel channel;
-        brpc::Controller cntl;
-        cntl.set_timeout_ms(kTimeoutMs);
-
-        if (channel.Init(leader.addr, nullptr) != 0) {
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        MetadataService_Stub stub(&channel);
-        stub.createfile(&cntl, &req, &resp, nullptr);
-
-        if (cntl.Failed()) {
-            LOG(WARNING) << "createfile() to " << leader
-                         << " failed: " << cntl.ErrorText();
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        return {Status::OK(), resp};
-    }
-    return {Status::IOError("create_file() failed after retries"),
-            Attributes()};
+    Status s =
+        call("createfile", &MetadataService_Stub::createfile, req, &resp);
+    return {s, resp};
 }
 
 std::pair<Status, Attributes>
@@ -200,35 +214,8 @@ MetadataClient::create_dir(const uint64_t &p_inode, const std::string &name) {
     req.set_p_inode(p_inode);
     req.set_name(name);
     Attributes resp;
-
-    for (int tries = 0; tries < kMaxRetries; ++tries) {
-        braft::PeerId leader;
-        if (!pick_leader(&leader)) {
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        brpc::Channel channel;
-        brpc::Controller cntl;
-        cntl.set_timeout_ms(kTimeoutMs);
-
-        if (channel.Init(leader.addr, nullptr) != 0) {
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        MetadataService_Stub stub(&channel);
-        stub.createdir(&cntl, &req, &resp, nullptr);
-
-        if (cntl.Failed()) {
-            LOG(WARNING) << "createdir() to " << leader
-                         << " failed: " << cntl.ErrorText();
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        return {Status::OK(), resp};
-    }
-    return {Status::IOError("create_dir() failed after retries"), Attributes()};
+    Status s = call("createdir", &MetadataService_Stub::createdir, req, &resp);
+    return {s, resp};
 }
 
 Status MetadataClient::remove_file(const uint64_t &p_inode,
@@ -239,35 +226,7 @@ Status MetadataClient::remove_file(const uint64_t &p_inode,
     req.set_inode(inode);
     req.set_name(name);
     google::protobuf::Empty resp;
-
-    for (int tries = 0; tries < kMaxRetries; ++tries) {
-        braft::PeerId leader;
-        if (!pick_leader(&leader)) {
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        brpc::Channel channel;
-        brpc::Controller cntl;
-        cntl.set_timeout_ms(kTimeoutMs);
-
-        if (channel.Init(leader.addr, nullptr) != 0) {
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        MetadataService_Stub stub(&channel);
-        stub.removefile(&cntl, &req, &resp, nullptr);
-
-        if (cntl.Failed()) {
-            LOG(WARNING) << "removefile() to " << leader
-                         << " failed: " << cntl.ErrorText();
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        return Status::OK();
-    }
-    return Status::IOError("remove_file() failed after retries");
+    return call("removefile", &MetadataService_Stub::removefile, req, &resp);
 }
 
 Status MetadataClient::remove_dir(const uint64_t &p_inode,
@@ -278,35 +237,7 @@ Status MetadataClient::remove_dir(const uint64_t &p_inode,
     req.set_inode(inode);
     req.set_name(name);
     google::protobuf::Empty resp;
-
-    for (int tries = 0; tries < kMaxRetries; ++tries) {
-        braft::PeerId leader;
-        if (!pick_leader(&leader)) {
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        brpc::Channel channel;
-        brpc::Controller cntl;
-        cntl.set_timeout_ms(kTimeoutMs);
-
-        if (channel.Init(leader.addr, nullptr) != 0) {
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        MetadataService_Stub stub(&channel);
-        stub.removedir(&cntl, &req, &resp, nullptr);
-
-        if (cntl.Failed()) {
-            LOG(WARNING) << "removedir() to " << leader
-                         << " failed: " << cntl.ErrorText();
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        return Status::OK();
-    }
-    return Status::IOError("remove_dir() failed after retries");
+    return call("removedir", &MetadataService_Stub::removedir, req, &resp);
 }
 
 Status MetadataClient::rename_file(const uint64_t &old_p_inode,
@@ -319,35 +250,7 @@ Status MetadataClient::rename_file(const uint64_t &old_p_inode,
     req.set_inode(inode);
     req.set_new_name(new_name);
     google::protobuf::Empty resp;
-
-    for (int tries = 0; tries < kMaxRetries; ++tries) {
-        braft::PeerId leader;
-        if (!pick_leader(&leader)) {
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        brpc::Channel channel;
-        brpc::Controller cntl;
-        cntl.set_timeout_ms(kTimeoutMs);
-
-        if (channel.Init(leader.addr, nullptr) != 0) {
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        MetadataService_Stub stub(&channel);
-        stub.renamefile(&cntl, &req, &resp, nullptr);
-
-        if (cntl.Failed()) {
-            LOG(WARNING) << "renamefile() to " << leader
-                         << " failed: " << cntl.ErrorText();
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        return Status::OK();
-    }
-    return Status::IOError("rename_file() failed after retries");
+    return call("renamefile", &MetadataService_Stub::renamefile, req, &resp);
 }
 
 Status MetadataClient::rename_dir(const uint64_t &old_p_inode,
@@ -360,70 +263,12 @@ Status MetadataClient::rename_dir(const uint64_t &old_p_inode,
     req.set_inode(inode);
     req.set_new_name(new_name);
     google::protobuf::Empty resp;
-
-    for (int tries = 0; tries < kMaxRetries; ++tries) {
-        braft::PeerId leader;
-        if (!pick_leader(&leader)) {
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        brpc::Channel channel;
-        brpc::Controller cntl;
-        cntl.set_timeout_ms(kTimeoutMs);
-
-        if (channel.Init(leader.addr, nullptr) != 0) {
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        MetadataService_Stub stub(&channel);
-        stub.renamedir(&cntl, &req, &resp, nullptr);
-
-        if (cntl.Failed()) {
-            LOG(WARNING) << "renamedir() to " << leader
-                         << " failed: " << cntl.ErrorText();
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        return Status::OK();
-    }
-    return Status::IOError("rename_dir() failed after retries");
+    return call("renamedir", &MetadataService_Stub::renamedir, req, &resp);
 }
 
-// setattr → RPC
 Status MetadataClient::setattr(const Attributes &attr) {
-    Attributes req = attr;
     Attributes resp;
-
-    for (int tries = 0; tries < kMaxRetries; ++tries) {
-        braft::PeerId leader;
-        if (!pick_leader(&leader)) {
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        brpc::Channel channel;
-        brpc::Controller cntl;
-        cntl.set_timeout_ms(kTimeoutMs);
-
-        if (channel.Init(leader.addr, nullptr) != 0) {
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        MetadataService_Stub stub(&channel);
-        stub.setattr(&cntl, &req, &resp, nullptr);
-
-        if (cntl.Failed()) {
-            LOG(WARNING) << "setattr() to " << leader
-                         << " failed: " << cntl.ErrorText();
-            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
-            usleep(kRetryBackoffUs);
-            continue;
-        }
-        return Status::OK();
-    }
-    return Status::IOError("setattr() failed after retries");
+    return call("setattr", &MetadataService_Stub::setattr, attr, &resp);
 }
 
 std::pair<Status, ChunksLocation>
@@ -431,9 +276,14 @@ MetadataClient::get_chunks(const uint64_t &inode) {
     ChunksRequest req;
     req.set_inode(inode);
     ChunksLocation resp;
-    brpc::Controller cntl;
-    stub_->getchunks(&cntl, &req, &resp, nullptr);
-    if (cntl.Failed())
-        return {Status::IOError(cntl.ErrorText()), ChunksLocation()};
-    return {Status::OK(), resp};
+    Status s = call("getchunks", &MetadataService_Stub::getchunks, req, &resp);
+    return {s, resp};
+}
+
+std::pair<Status, NodeMap> MetadataClient::get_node_map() {
+    google::protobuf::Empty req;
+    NodeMap resp;
+    Status s =
+        call("getnodemap", &MetadataService_Stub::getnodemap, req, &resp);
+    return {s, resp};
 }
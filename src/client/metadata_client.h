@@ -2,8 +2,13 @@
 
 #include "metadata.pb.h"
 #include "status.h"
+#include <atomic>
 #include <brpc/channel.h>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 class MetadataClient {
@@ -12,7 +17,18 @@ class MetadataClient {
     ~MetadataClient() = default;
 
     std::pair<Status, Attributes> getattr(const uint64_t &inode);
-    std::pair<Status, std::vector<Dirent>> readdir(const uint64_t &inode);
+    // Attributes of the entry `name` of directory p_inode, NotFound if there
+    // is none
+    std::pair<Status, Attributes> lookup(const uint64_t &p_inode,
+                                         const std::string &name);
+    // One page of a directory listing, see ReadDirRequest
+    std::pair<Status, ReadDirResponse> readdir(const uint64_t &inode,
+                                               const std::string &start_after,
+                                               uint32_t max_entries = 0);
+    // Same with the attributes of the entries
+    std::pair<Status, ReadDirPlusResponse>
+    readdirplus(const uint64_t &inode, const std::string &start_after,
+                uint32_t max_entries = 0);
     std::pair<Status, FileInfo> open(const uint64_t &inode);
 
     std::pair<Status, Attributes> create_file(const uint64_t &p_inode,
@@ -33,8 +49,33 @@ class MetadataClient {
     Status setattr(const Attributes &attr);
 
     std::pair<Status, ChunksLocation> get_chunks(const uint64_t &inode);
+    std::pair<Status, NodeMap> get_node_map();
 
   private:
-    brpc::Channel channel_;
-    MetadataService_Stub *stub_;
+    template <typename Request, typename Response>
+    using Method = void (MetadataService_Stub::*)(
+        google::protobuf::RpcController *, const Request *, Response *,
+        google::protobuf::Closure *);
+
+    // One channel per metadata peer, kept for the life of the client. A
+    // leader change only switches to another peer's channel.
+    std::mutex channels_mu_;
+    std::unordered_map<std::string, std::shared_ptr<brpc::Channel>> channels_;
+
+    // All peers of the group, reads are spread over them
+    std::vector<butil::EndPoint> peers_;
+    std::atomic<uint32_t> next_peer_{0};
+
+    std::shared_ptr<brpc::Channel> channel(const butil::EndPoint &addr);
+
+    // Sends a request to the leader with `method`, retrying when the RPC
+    // fails or the leader changed. The leader answering ENOENT is NotFound.
+    template <typename Request, typename Response>
+    Status call(const char *name, Method<Request, Response> method,
+                const Request &req, Response *resp);
+    // Same for reads, which any peer answers once it caught up with the
+    // leader. Goes to the next peer in turn and to the leader if that fails.
+    template <typename Request, typename Response>
+    Status call_read(const char *name, Method<Request, Response> method,
+                     const Request &req, Response *resp);
 };
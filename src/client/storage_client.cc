@@ -1,229 +1,522 @@
 #include "storage_client.h"
+#include "ec_backend.h"
+#include <algorithm>
+#include <brpc/callback.h>
+#include <bthread/condition_variable.h>
+#include <bthread/countdown_event.h>
+#include <bthread/mutex.h>
+#include <butil/time.h>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <gflags/gflags.h>
 #include <google/protobuf/empty.pb.h>
 #include <iostream>
 #include <liberasurecode/erasurecode.h>
 #include <stdexcept>
 #include <utility>
 
+DEFINE_uint64(stripe_size, 8 * 1024 * 1024,
+              "Size of the stripe units, in bytes, of files created before "
+              "their EC profile recorded one");
+
+static bool validate_stripe_size(const char * /*flag*/, uint64_t value) {
+    // Big enough to amortize the per-stripe RPCs, small enough to bound the
+    // encode/decode buffers.
+    return value >= 4 * 1024 * 1024 && value <= 16 * 1024 * 1024;
+}
+DEFINE_validator(stripe_size, &validate_stripe_size);
+
+DEFINE_bool(ec_self_test, false,
+            "Measure the encode/decode throughput of every available EC "
+            "backend at startup");
+
+DEFINE_int32(node_map_refresh_ms, 2000,
+             "Interval between refreshes of the storage node map");
+
+DEFINE_bool(hedged_reads, true,
+            "Also ask the parity nodes when data fragments are slow, and "
+            "decode from the first K fragments that arrive");
+DEFINE_int32(hedge_percentile, 95,
+             "Fragment read latency percentile after which a hedged read asks "
+             "the parity nodes; 0 asks all K+M nodes right away");
+DEFINE_int32(hedge_min_delay_us, 1000,
+             "Lower bound on the hedge delay, also used until enough "
+             "latencies have been recorded");
+
 // Helper struct to capture a single read-RPC result
 struct FragmentResult {
     std::string node_name;
     bool        ok;
-    std::string payload;
+    butil::IOBuf payload;
     uint64_t    len;
     std::string error_text;
 };
 
-// Launch one read_chunk RPC against `node` and return a FragmentResult
-static FragmentResult fetch_one_fragment(
+// One in-flight read_chunk RPC. Calls are kept in a std::deque so their
+// addresses stay put while brpc fills them in.
+struct ReadCall {
+    std::string      node;
+    ReadRequest      req;
+    Data             resp;
+    brpc::Controller cntl;
+};
+
+// One in-flight write_chunk RPC
+struct WriteCall {
+    std::string      node;
+    WriteRequest     req;
+    WriteResponse    resp;
+    brpc::Controller cntl;
+};
+
+// The reads issued for one stripe. The caller waits on cv until enough of
+// them have succeeded, or all of them have completed.
+// Waited on with bthread primitives, since stripes are read from bthreads
+struct ReadRound {
+    bthread::Mutex             mu;
+    bthread::ConditionVariable cv;
+    int                     issued = 0;
+    int                     completed = 0;
+    int                     succeeded = 0;
+    bvar::LatencyRecorder  *latency = nullptr;
+};
+
+static void signal_event(bthread::CountdownEvent *event) {
+    event->signal();
+}
+
+static void on_fragment_read(ReadCall *call, ReadRound *round) {
+    bool ok = !call->cntl.Failed();
+    if (ok) {
+        *round->latency << call->cntl.latency_us();
+    }
+    std::lock_guard<bthread::Mutex> lock(round->mu);
+    round->completed++;
+    if (ok) round->succeeded++;
+    round->cv.notify_all();
+}
+
+// Issue one read_chunk RPC against `node` without waiting for it; `round`
+// is updated when it completes. A non-zero length only fetches
+// [offset, offset + length) of the fragment.
+static void start_fragment_read(
+    ReadCall *call,
     const std::string &node,
     const std::string &file_id,
-    StorageService_Stub *stub)
+    StorageService_Stub *stub,
+    uint64_t offset,
+    uint64_t length,
+    ReadRound *round)
 {
-    ReadRequest req;
-    req.set_chunk_id(file_id);
-
-    Data resp;
-    brpc::Controller cntl;
-    stub->read_chunk(&cntl, &req, &resp, nullptr);
-    if (cntl.Failed()) {
-        return FragmentResult{node, false, "", 0, cntl.ErrorText()};
-    } else {
-        return FragmentResult{node, true,
-                              std::string(resp.payload()), resp.len(), ""};
+    call->node = node;
+    call->req.set_chunk_id(file_id);
+    if (offset > 0 || length > 0) {
+        call->req.set_offset(offset);
+        call->req.set_length(length);
+    }
+    {
+        std::lock_guard<bthread::Mutex> lock(round->mu);
+        round->issued++;
     }
+    stub->read_chunk(&call->cntl, &call->req, &call->resp,
+                     brpc::NewCallback(&on_fragment_read, call, round));
 }
 
-// Helper struct to capture a single write-RPC result
-struct WriteResult {
-    std::string node_name;
-    bool        ok;
-    std::string error_text;
-};
+// Turn a completed ReadCall into a FragmentResult
+static FragmentResult finish_fragment_read(ReadCall *call) {
+    if (call->cntl.Failed()) {
+        return FragmentResult{call->node, false, butil::IOBuf(), 0,
+                              call->cntl.ErrorText()};
+    }
+    if (call->cntl.response_attachment().size() != call->resp.len()) {
+        return FragmentResult{call->node, false, butil::IOBuf(), 0,
+                              "Attachment size does not match data length"};
+    }
+    // Keep the payload in the blocks it arrived in
+    FragmentResult fr{call->node, true, butil::IOBuf(), call->resp.len(), ""};
+    fr.payload.swap(call->cntl.response_attachment());
+    return fr;
+}
 
-// Launch one write_chunk RPC to `node` with the given payload
-static WriteResult send_one_fragment(
+// Issue one write_chunk RPC to `node` with the given payload without
+// waiting for it; `event` is signalled when it completes. A negative offset
+// replaces the whole fragment, otherwise the payload is written in place at
+// that offset.
+static void start_fragment_write(
+    WriteCall *call,
     const std::string &node,
     const std::string &file_id,
     const char        *payload,
     uint64_t           len,
-    StorageService_Stub *stub)
+    StorageService_Stub *stub,
+    int64_t            offset,
+    bthread::CountdownEvent *event)
 {
-    Data node_data;
-    node_data.set_len(len);
-    node_data.set_payload(std::string(payload, len));
+    call->node = node;
+    call->req.set_chunk_id(file_id);
+    call->req.mutable_data()->set_len(len);
+    if (offset >= 0) {
+        call->req.set_offset(offset);
+    }
 
-    WriteRequest req;
-    req.set_chunk_id(file_id);
-    *req.mutable_data() = node_data;
+    // The fragment is copied once, into the attachment, and goes out from
+    // there. It is not wrapped in place because the encoder frees it once
+    // the writes are joined, while a timed-out RPC may still hold it.
+    call->cntl.request_attachment().append(payload, len);
+    stub->write_chunk(&call->cntl, &call->req, &call->resp,
+                      brpc::NewCallback(&signal_event, event));
+}
 
-    WriteResponse resp;
-    brpc::Controller cntl;
-    stub->write_chunk(&cntl, &req, &resp, nullptr);
-    if (cntl.Failed()) {
-        return WriteResult{node, false, cntl.ErrorText()};
-    } else {
-        return WriteResult{node, true, ""};
+StorageClient::StorageClient(std::shared_ptr<MetadataClient> metadata)
+    : metadata_(std::move(metadata)) {
+    // Nodes may register after the client starts, so this is not fatal
+    Status s = refresh_nodes();
+    if (!s.ok()) {
+        std::cerr << "[WARN] Can't fetch the storage node map: " << s.ToString()
+                  << std::endl;
+    }
+    refresher_ = std::thread(&StorageClient::refresh_loop, this);
+
+    std::cout << "[INFO] Preferred EC backend: " << ECBackends::preferred()
+              << std::endl;
+    if (FLAGS_ec_self_test) {
+        ECBackends::self_test(4, 2, FLAGS_stripe_size);
     }
 }
 
-StorageClient::StorageClient() {
-    const std::vector<std::pair<std::string, std::string>> servers = {
-        {"node1", "127.0.0.1:9001"}, {"node2", "127.0.0.1:9002"},
-        {"node3", "127.0.0.1:9003"}, {"node4", "127.0.0.1:9004"},
-        {"node5", "127.0.0.1:9005"}, {"node6", "127.0.0.1:9006"}};
-
-    for (const auto &entry : servers) {
-        const std::string &server_name = entry.first;
-        const std::string &address = entry.second;
-        auto node = std::make_unique<StorageNode>();
-        brpc::ChannelOptions options;
-        options.protocol = "baidu_std";
-        options.timeout_ms = 1000;
-        options.max_retry = 3;
-        if (node->channel.Init(address.c_str(), "", &options) != 0) {
-            throw std::runtime_error("Failed to initialize channel to " +
-                                     address);
+StorageClient::~StorageClient() {
+    {
+        std::lock_guard<std::mutex> lock(refresher_mu_);
+        stopping_ = true;
+    }
+    refresher_cv_.notify_all();
+    if (refresher_.joinable()) {
+        refresher_.join();
+    }
+    nodes_.clear();
+    for (const auto &entry : ec_instances_) {
+        liberasurecode_instance_destroy(entry.second);
+    }
+}
+
+Status StorageClient::refresh_nodes() {
+    auto [s, map] = metadata_->get_node_map();
+    if (!s.ok()) {
+        return s;
+    }
+
+    std::unique_lock lock(nodes_mu_);
+    if (map.version() != node_map_version_) {
+        // Keep the channels of nodes that didn't move
+        std::unordered_map<std::string, std::shared_ptr<StorageNode>> next;
+        for (const auto &info : map.nodes()) {
+            auto it = nodes_.find(info.name());
+            if (it != nodes_.end() && it->second->address == info.address()) {
+                next.emplace(info.name(), it->second);
+                continue;
+            }
+            auto node = std::make_shared<StorageNode>();
+            node->address = info.address();
+            brpc::ChannelOptions options;
+            options.protocol = "baidu_std";
+            options.timeout_ms = 1000;
+            options.max_retry = 3;
+            if (node->channel.Init(info.address().c_str(), "", &options) != 0) {
+                std::cerr << "[WARN] Failed to initialize channel to "
+                          << info.name() << " at " << info.address()
+                          << std::endl;
+                continue;
+            }
+            node->stub = std::make_unique<StorageService_Stub>(&node->channel);
+            next.emplace(info.name(), std::move(node));
         }
-        node->stub = std::make_unique<StorageService_Stub>(&node->channel);
-        nodes_.emplace(server_name, std::move(node));
+        nodes_.swap(next);
+        node_map_version_ = map.version();
+        std::cout << "[INFO] Storage node map version " << node_map_version_
+                  << ": " << nodes_.size() << " nodes" << std::endl;
     }
 
-    struct ec_args args = { .k = EC_K, .m = EC_M };
-    ec_descriptor_ = liberasurecode_instance_create(
-        EC_BACKEND_LIBERASURECODE_RS_VAND, &args);
-    if (!ec_descriptor_) {
-        throw std::runtime_error("Failed to create erasure code instance\n");
+    for (const auto &info : map.nodes()) {
+        auto it = nodes_.find(info.name());
+        if (it != nodes_.end()) {
+            it->second->alive = info.alive();
+        }
     }
+    return Status::OK();
 }
 
-StorageClient::~StorageClient() {
-    nodes_.clear();
-    liberasurecode_instance_destroy(ec_descriptor_);
+void StorageClient::refresh_loop() {
+    std::unique_lock<std::mutex> lock(refresher_mu_);
+    while (!refresher_cv_.wait_for(
+        lock, std::chrono::milliseconds(FLAGS_node_map_refresh_ms),
+        [this] { return stopping_; })) {
+        lock.unlock();
+        Status s = refresh_nodes();
+        if (!s.ok()) {
+            std::cerr << "[WARN] Can't refresh the storage node map: "
+                      << s.ToString() << std::endl;
+        }
+        lock.lock();
+    }
 }
 
-std::pair<Status, Data>
-StorageClient::read(const std::vector<std::string> &data_nodes,
-                    const std::vector<std::string> &parity_nodes,
-                    const std::string &file_id) {
-    if (data_nodes.size() != EC_K || parity_nodes.size() != EC_M) {
-        return {Status::IOError("Invalid node configuration"), Data()};
+std::shared_ptr<StorageNode> StorageClient::node(const std::string &name) {
+    {
+        std::shared_lock lock(nodes_mu_);
+        auto it = nodes_.find(name);
+        if (it != nodes_.end()) {
+            return it->second;
+        }
+    }
+    if (!refresh_nodes().ok()) {
+        return nullptr;
+    }
+    std::shared_lock lock(nodes_mu_);
+    auto it = nodes_.find(name);
+    return it != nodes_.end() ? it->second : nullptr;
+}
+
+std::pair<Status, uint64_t>
+StorageClient::read(const ECProfile &profile,
+                    const std::vector<std::string> &file_data_nodes,
+                    const std::vector<std::string> &file_parity_nodes,
+                    const std::string &file_id, uint64_t stripe,
+                    char *dest) {
+    auto [ec_s, ec_descriptor] = ec_instance(profile);
+    if (!ec_s.ok()) {
+        return {ec_s, 0};
+    }
+    const int k = profile.k();
+    const int m = profile.m();
+    if (file_data_nodes.size() != profile.k() ||
+        file_parity_nodes.size() != profile.m()) {
+        return {Status::IOError("Invalid node configuration"), 0};
+    }
+
+    std::vector<std::string> data_nodes, parity_nodes;
+    place_stripe(file_data_nodes, file_parity_nodes, stripe, &data_nodes,
+                 &parity_nodes);
+    std::string chunk_id = stripe_id(file_id, stripe);
+
+    // Data nodes first, then parity nodes
+    std::vector<std::shared_ptr<StorageNode>> stripe_nodes;
+    for (int i = 0; i < k + m; ++i) {
+        const std::string &name = i < k ? data_nodes[i] : parity_nodes[i - k];
+        stripe_nodes.push_back(node(name));
+        if (!stripe_nodes.back()) {
+            return {Status::IOError("Node not found: " + name), 0};
+        }
+    }
+    bool data_node_down = std::any_of(
+        stripe_nodes.begin(), stripe_nodes.begin() + k,
+        [](const std::shared_ptr<StorageNode> &n) { return !n->alive; });
+
+    // 1) Launch all K data-node reads at once
+    std::deque<ReadCall> calls(k + m);
+    ReadRound round;
+    round.latency = &fragment_latency_;
+    for (int i = 0; i < k; ++i) {
+        const std::string &node = data_nodes[i];
+        start_fragment_read(&calls[i], node, chunk_id,
+                            stripe_nodes[i]->stub.get(), 0, 0, &round);
+    }
+
+    // 2) Wait for them, for at most the hedge delay when hedging. A failed
+    // data read ends the wait too, since parity is needed either way, and
+    // there is no wait when the metadata service reports a data node dead.
+    auto data_settled = [&round, k] {
+        return round.succeeded >= k || round.completed > round.succeeded;
+    };
+    if (!data_node_down) {
+        std::unique_lock<bthread::Mutex> lock(round.mu);
+        int64_t deadline_us = butil::monotonic_time_us() + hedge_delay_us();
+        while (!data_settled()) {
+            if (!FLAGS_hedged_reads) {
+                round.cv.wait(lock);
+                continue;
+            }
+            int64_t left_us = deadline_us - butil::monotonic_time_us();
+            if (left_us <= 0) {
+                break;
+            }
+            round.cv.wait_for(lock, left_us);
+        }
     }
 
-    // 1) Launch all K data-node reads in parallel
-    std::vector<std::future<FragmentResult>> data_futures;
-    data_futures.reserve(EC_K);
+    // 3) If fewer than K are in, ask the parity nodes as well and take
+    // whichever K fragments arrive first
+    bool need_parity;
+    {
+        std::lock_guard<bthread::Mutex> lock(round.mu);
+        need_parity = round.succeeded < k;
+    }
+    if (need_parity) {
+        for (int i = 0; i < m; ++i) {
+            const std::string &node = parity_nodes[i];
+            start_fragment_read(&calls[k + i], node, chunk_id,
+                                stripe_nodes[k + i]->stub.get(), 0, 0,
+                                &round);
+        }
+        std::unique_lock<bthread::Mutex> lock(round.mu);
+        while (round.succeeded < k && round.completed < round.issued) {
+            round.cv.wait(lock);
+        }
+    }
 
-    for (const auto &node : data_nodes) {
-        if (!nodes_.contains(node)) {
-            return {Status::IOError("Node not found: " + node), Data()};
+    // 4) Cancel the stragglers, and wait for their closures to run before
+    // the calls go out of scope
+    int issued = k + (need_parity ? m : 0);
+    for (int i = 0; i < issued; ++i) {
+        brpc::StartCancel(calls[i].cntl.call_id());
+    }
+    {
+        std::unique_lock<bthread::Mutex> lock(round.mu);
+        while (round.completed < round.issued) {
+            round.cv.wait(lock);
         }
-        StorageService_Stub *stub = nodes_[node]->stub.get();
-        data_futures.push_back(
-            std::async(std::launch::async,
-                       &fetch_one_fragment,
-                       node,
-                       file_id,
-                       stub));
-    }
-
-    // 2) Collect results
-    std::vector<std::string> fragment_data;
-    fragment_data.reserve(EC_K);
+    }
+
+    // 5) Collect results. Fragments carry their index in their header, so
+    // any K of them decode, in any order.
+    std::vector<butil::IOBuf> fragment_data;
+    fragment_data.reserve(k);
     uint64_t frag_len = 0;
 
-    for (auto &fut : data_futures) {
-        FragmentResult fr = fut.get();
+    for (int i = 0; i < issued && fragment_data.size() < static_cast<size_t>(k); ++i) {
+        FragmentResult fr = finish_fragment_read(&calls[i]);
         if (fr.ok) {
             if (frag_len == 0) frag_len = fr.len;
             else                assert(frag_len == fr.len);
             fragment_data.push_back(std::move(fr.payload));
-        } else {
-            std::cerr << "Failed to read from data node "
+        } else if (calls[i].cntl.ErrorCode() != ECANCELED) {
+            std::cerr << "Failed to read from node "
                       << fr.node_name << ": "
                       << fr.error_text << "\n";
         }
     }
 
-    // 3) If fewer than K, launch parity reads in parallel to fill missing
-    if (fragment_data.size() < EC_K) {
-        std::vector<std::future<FragmentResult>> parity_futures;
-        parity_futures.reserve(EC_M);
+    // 6) If still fewer than K, error
+    if (fragment_data.size() < static_cast<size_t>(k)) {
+        return {Status::IOError("Insufficient fragments for reconstruction"), 0};
+    }
 
-        for (const auto &node : parity_nodes) {
-            if (!nodes_.contains(node)) {
-                return {Status::IOError("Node not found: " + node), Data()};
-            }
-            StorageService_Stub *stub = nodes_[node]->stub.get();
-            parity_futures.push_back(
-                std::async(std::launch::async,
-                           &fetch_one_fragment,
-                           node,
-                           file_id,
-                           stub));
+    // 7) Fast path: the code is systematic, so fragments 0..K-1 hold the
+    // stripe as-is behind their header. When all of them are in, the stripe
+    // is stitched together straight into dest and nothing is decoded.
+    std::vector<const butil::IOBuf *> systematic(k, nullptr);
+    std::vector<uint32_t> systematic_size(k, 0);
+    uint64_t stripe_len = 0;
+    bool plain_layout = true;
+    for (const auto &frag : fragment_data) {
+        fragment_header_t header;
+        if (frag.copy_to(&header, sizeof(header)) != sizeof(header)) {
+            return {Status::IOError("Truncated fragment header"), 0};
         }
-
-        for (auto &fut : parity_futures) {
-            if (fragment_data.size() >= EC_K) break;
-            FragmentResult fr = fut.get();
-            if (fr.ok) {
-                fragment_data.push_back(std::move(fr.payload));
-            } else {
-                std::cerr << "Failed to read from parity node "
-                          << fr.node_name << ": "
-                          << fr.error_text << "\n";
-            }
+        fragment_metadata_t meta;
+        if (liberasurecode_get_fragment_metadata(
+                reinterpret_cast<char *>(&header), &meta) != 0) {
+            return {Status::IOError("Bad fragment header"), 0};
+        }
+        stripe_len = meta.orig_data_size;
+        plain_layout = plain_layout && meta.frag_backend_metadata_size == 0;
+        if (meta.idx < static_cast<uint32_t>(k)) {
+            systematic[meta.idx] = &frag;
+            systematic_size[meta.idx] = meta.size;
         }
     }
-
-    // 4) If still fewer than K, error
-    if (fragment_data.size() < EC_K) {
-        return {Status::IOError("Insufficient fragments for reconstruction"), Data()};
+    if (stripe_len > stripe_size(profile)) {
+        return {Status::IOError("Stripe larger than a stripe unit"), 0};
+    }
+    bool all_systematic =
+        std::find(systematic.begin(), systematic.end(), nullptr) ==
+        systematic.end();
+    if (all_systematic && plain_layout) {
+        uint64_t copied = 0;
+        for (int i = 0; i < k && copied < stripe_len; ++i) {
+            uint64_t n = std::min<uint64_t>(systematic_size[i],
+                                            stripe_len - copied);
+            if (systematic[i]->copy_to(dest + copied, n,
+                                       sizeof(fragment_header_t)) != n) {
+                return {Status::IOError("Truncated fragment payload"), 0};
+            }
+            copied += n;
+        }
+        if (copied != stripe_len) {
+            return {Status::IOError("Fragments shorter than the stripe"), 0};
+        }
+        return {Status::OK(), stripe_len};
     }
 
-    // 5) Prepare for decode
+    // 8) Degraded mode: prepare for decode. The decoder wants each fragment
+    // contiguous: a fragment that landed in a single IOBuf block is used
+    // where it is, the others are flattened with one copy.
     std::vector<char *> fragments;
+    std::vector<std::string> flattened;
     fragments.reserve(fragment_data.size());
+    flattened.reserve(fragment_data.size());
     for (auto &frag : fragment_data) {
-        fragments.push_back(const_cast<char *>(frag.data()));
+        if (frag.backing_block_num() == 1) {
+            fragments.push_back(
+                const_cast<char *>(frag.backing_block(0).data()));
+        } else {
+            flattened.emplace_back();
+            frag.copy_to(&flattened.back());
+            fragments.push_back(flattened.back().data());
+        }
     }
 
-    // 6) Decode
+    // 9) Decode
     char *decoded_data = nullptr;
     uint64_t decoded_len = 0;
     int res = liberasurecode_decode(
-        ec_descriptor_, fragments.data(), EC_K, frag_len, 0,
+        ec_descriptor, fragments.data(), k, frag_len, 0,
         &decoded_data, &decoded_len);
 
     if (res != 0) {
-        return {Status::IOError("Decode failed: " + std::to_string(res)), Data()};
+        return {Status::IOError("Decode failed: " + std::to_string(res)), 0};
     }
 
-    Data result;
-    result.set_len(decoded_len);
-    result.set_payload(std::string(decoded_data, decoded_len));
+    if (decoded_len > stripe_size(profile)) {
+        liberasurecode_decode_cleanup(ec_descriptor, decoded_data);
+        return {Status::IOError("Stripe larger than a stripe unit"), 0};
+    }
+    std::memcpy(dest, decoded_data, decoded_len);
 
-    res = liberasurecode_decode_cleanup(ec_descriptor_, decoded_data);
+    res = liberasurecode_decode_cleanup(ec_descriptor, decoded_data);
     if (res != 0) {
-        return {Status::IOError("Decode cleanup failed!"), Data()};
+        return {Status::IOError("Decode cleanup failed!"), 0};
     }
-    return {Status::OK(), result};
+    return {Status::OK(), decoded_len};
 }
 
 std::pair<Status, uint64_t>
-StorageClient::write(const std::vector<std::string> &data_nodes,
+StorageClient::write(const ECProfile &profile,
+                     const std::vector<std::string> &data_nodes,
                      const std::vector<std::string> &parity_nodes,
                      const std::string &file_id,
+                     uint64_t stripe,
                      const Data &data) {
-    if (data_nodes.size() != EC_K || parity_nodes.size() != EC_M) {
+    auto [ec_s, ec_descriptor] = ec_instance(profile);
+    if (!ec_s.ok()) {
+        return {ec_s, 0};
+    }
+    if (data_nodes.size() != profile.k() ||
+        parity_nodes.size() != profile.m()) {
         return {Status::IOError("Invalid node configuration"), 0};
     }
+    if (data.len() > stripe_size(profile)) {
+        return {Status::InvalidArgument("Data larger than a stripe unit"), 0};
+    }
 
     WriteJob job;
-    job.data_nodes   = data_nodes;
-    job.parity_nodes = parity_nodes;
-    job.file_id      = file_id;
+    job.ec_descriptor = ec_descriptor;
+    place_stripe(data_nodes, parity_nodes, stripe, &job.data_nodes,
+                 &job.parity_nodes);
+    job.file_id      = stripe_id(file_id, stripe);
     job.data_payload = data;
 
     // Perform write (blocking until all fragments written)
@@ -233,34 +526,212 @@ StorageClient::write(const std::vector<std::string> &data_nodes,
 
 Status StorageClient::remove_file(const std::vector<std::string> &data_nodes,
                                   const std::vector<std::string> &parity_nodes,
-                                  const std::string &file_id) {
-    if (data_nodes.size() != EC_K || parity_nodes.size() != EC_M) {
-        return {Status::IOError("Invalid node configuration")};
+                                  const std::string &file_id,
+                                  uint64_t num_stripes) {
+    return remove_stripes(data_nodes, parity_nodes, file_id, 0, num_stripes);
+}
+
+Status
+StorageClient::remove_stripes(const std::vector<std::string> &data_nodes,
+                              const std::vector<std::string> &parity_nodes,
+                              const std::string &file_id,
+                              uint64_t first_stripe, uint64_t end_stripe) {
+    const size_t k = data_nodes.size();
+    const size_t n = k + parity_nodes.size();
+    std::vector<std::shared_ptr<StorageNode>> file_nodes;
+    for (size_t i = 0; i < n; i++) {
+        const std::string &name =
+            (i < k) ? data_nodes[i] : parity_nodes[i - k];
+        file_nodes.push_back(node(name));
+        if (!file_nodes.back()) {
+            return {Status::IOError("Node not found: " + name)};
+        }
     }
 
-    for (size_t i = 0; i < EC_K + EC_M; i++) {
-        const std::string &node =
-            (i < EC_K) ? data_nodes[i] : parity_nodes[i - EC_K];
-        if (!nodes_.contains(node)) {
-            return {Status::IOError("Node not found: " + node)};
+    // Every node holds one fragment of every stripe, whatever its role
+    for (uint64_t stripe = first_stripe; stripe < end_stripe; stripe++) {
+        for (size_t i = 0; i < n; i++) {
+            const std::string &node =
+                (i < k) ? data_nodes[i] : parity_nodes[i - k];
+
+            DeleteRequest req;
+            req.set_chunk_id(stripe_id(file_id, stripe));
+            google::protobuf::Empty resp;
+            brpc::Controller cntl;
+
+            file_nodes[i]->stub->delete_chunk(&cntl, &req, &resp, nullptr);
+            if (cntl.Failed()) {
+                std::cerr << "Failed to delete file from node " << node
+                          << ": " << cntl.ErrorText() << "\n";
+                return Status::IOError(cntl.ErrorText());
+            }
         }
+    }
+
+    return Status::OK();
+}
 
-        DeleteRequest req;
-        req.set_chunk_id(file_id);
-        google::protobuf::Empty resp;
-        brpc::Controller cntl;
+uint64_t StorageClient::stripe_size(const ECProfile &profile) const {
+    if (profile.has_stripe_size() && profile.stripe_size() > 0) {
+        return profile.stripe_size();
+    }
+    return FLAGS_stripe_size;
+}
 
-        nodes_[node]->stub->delete_chunk(&cntl, &req, &resp, nullptr);
-        if (cntl.Failed()) {
-            std::cerr << "Failed to delete file from node " << node
-                      << ": " << cntl.ErrorText() << "\n";
-            return Status::IOError(cntl.ErrorText());
+Status StorageClient::parse_profile(const std::string &text,
+                                    ECProfile *profile) {
+    ECProfile parsed;
+    bool has_k = false, has_m = false;
+    size_t pos = 0;
+    while (pos <= text.size()) {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos) end = text.size();
+        std::string item = text.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.empty()) continue;
+
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            return Status::InvalidArgument("Malformed EC profile entry: " +
+                                           item);
+        }
+        std::string key = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+        try {
+            if (key == "k") {
+                parsed.set_k(std::stoul(value));
+                has_k = true;
+            } else if (key == "m") {
+                parsed.set_m(std::stoul(value));
+                has_m = true;
+            } else if (key == "backend") {
+                parsed.set_backend(value);
+            } else if (key == "stripe_size") {
+                parsed.set_stripe_size(std::stoull(value));
+            } else {
+                return Status::InvalidArgument("Unknown EC profile key: " +
+                                               key);
+            }
+        } catch (const std::exception &) {
+            return Status::InvalidArgument("Bad EC profile value: " + item);
         }
     }
+    if (!has_k || !has_m) {
+        return Status::InvalidArgument("EC profile needs both k and m");
+    }
 
+    Status s = validate_profile(parsed);
+    if (!s.ok()) {
+        return s;
+    }
+    *profile = parsed;
     return Status::OK();
 }
 
+std::string StorageClient::format_profile(const ECProfile &profile) {
+    std::string text = "k=" + std::to_string(profile.k()) +
+                       ",m=" + std::to_string(profile.m());
+    if (!profile.backend().empty()) {
+        text += ",backend=" + profile.backend();
+    }
+    if (profile.stripe_size() > 0) {
+        text += ",stripe_size=" + std::to_string(profile.stripe_size());
+    }
+    return text;
+}
+
+Status StorageClient::validate_profile(const ECProfile &profile) {
+    if (profile.k() < 1 || profile.m() < 1 ||
+        profile.k() + profile.m() > EC_MAX_FRAGMENTS) {
+        return Status::InvalidArgument("EC profile needs k >= 1, m >= 1 and "
+                                       "k + m <= " +
+                                       std::to_string(EC_MAX_FRAGMENTS));
+    }
+    ec_backend_id_t id;
+    if (!profile.backend().empty() &&
+        !ECBackends::lookup(profile.backend(), &id)) {
+        return Status::InvalidArgument("Unknown EC backend: " +
+                                       profile.backend());
+    }
+    if (profile.stripe_size() > 0 &&
+        !validate_stripe_size("stripe_size", profile.stripe_size())) {
+        return Status::InvalidArgument("Stripe size out of range");
+    }
+    return Status::OK();
+}
+
+std::pair<Status, int> StorageClient::ec_instance(const ECProfile &profile) {
+    Status s = validate_profile(profile);
+    if (!s.ok()) {
+        return {s, 0};
+    }
+    std::string backend = profile.backend().empty() ? ECBackends::preferred()
+                                                    : profile.backend();
+    std::string key = backend + ":" + std::to_string(profile.k()) + ":" +
+                      std::to_string(profile.m());
+
+    std::lock_guard<std::mutex> lock(ec_mu_);
+    auto it = ec_instances_.find(key);
+    if (it != ec_instances_.end()) {
+        return {Status::OK(), it->second};
+    }
+
+    ec_backend_id_t id;
+    ECBackends::lookup(backend, &id);
+    if (!ECBackends::is_available(backend)) {
+        return {Status::IOError("EC backend not installed on this host: " +
+                                backend),
+                0};
+    }
+
+    struct ec_args args = {};
+    args.k = profile.k();
+    args.m = profile.m();
+    int desc = liberasurecode_instance_create(id, &args);
+    if (desc <= 0) {
+        return {Status::IOError("Failed to create erasure code instance for " +
+                                key),
+                0};
+    }
+    ec_instances_.emplace(key, desc);
+    return {Status::OK(), desc};
+}
+
+int64_t StorageClient::hedge_delay_us() const {
+    if (FLAGS_hedge_percentile <= 0) {
+        return 0;
+    }
+    int64_t delay =
+        fragment_latency_.latency_percentile(FLAGS_hedge_percentile / 100.0);
+    return std::max<int64_t>(delay, FLAGS_hedge_min_delay_us);
+}
+
+void StorageClient::place_stripe(const std::vector<std::string> &data_nodes,
+                                 const std::vector<std::string> &parity_nodes,
+                                 uint64_t stripe,
+                                 std::vector<std::string> *stripe_data_nodes,
+                                 std::vector<std::string> *stripe_parity_nodes) const {
+    const size_t n = data_nodes.size() + parity_nodes.size();
+    stripe_data_nodes->clear();
+    stripe_parity_nodes->clear();
+    for (size_t i = 0; i < n; i++) {
+        size_t j = (i + stripe) % n;
+        const std::string &node = (j < data_nodes.size())
+                                      ? data_nodes[j]
+                                      : parity_nodes[j - data_nodes.size()];
+        if (i < data_nodes.size()) {
+            stripe_data_nodes->push_back(node);
+        } else {
+            stripe_parity_nodes->push_back(node);
+        }
+    }
+}
+
+std::string StorageClient::stripe_id(const std::string &file_id,
+                                     uint64_t stripe) {
+    return file_id + "_" + std::to_string(stripe);
+}
+
 void StorageClient::process_write(const WriteJob &job) {
     // 1) Erasure-encode
     char **data_fragments   = nullptr;
@@ -268,7 +739,7 @@ void StorageClient::process_write(const WriteJob &job) {
     uint64_t fragment_len   = 0;
 
     int r = liberasurecode_encode(
-        ec_descriptor_,
+        job.ec_descriptor,
         job.data_payload.payload().data(),
         job.data_payload.len(),
         &data_fragments,
@@ -276,58 +747,56 @@ void StorageClient::process_write(const WriteJob &job) {
         &fragment_len);
     if (r != 0) {
         if (data_fragments)
-            liberasurecode_encode_cleanup(ec_descriptor_, data_fragments, nullptr);
+            liberasurecode_encode_cleanup(job.ec_descriptor, data_fragments, nullptr);
         if (parity_fragments)
-            liberasurecode_encode_cleanup(ec_descriptor_, nullptr, parity_fragments);
+            liberasurecode_encode_cleanup(job.ec_descriptor, nullptr, parity_fragments);
         return;
     }
 
-    // 2) Launch all K+M writes in parallel
-    std::vector<std::future<WriteResult>> write_futures;
-    write_futures.reserve(EC_K + EC_M);
+    // 2) Launch all K+M writes at once
+    std::deque<WriteCall> write_calls;
+    bthread::CountdownEvent write_done(0);
+
+    std::vector<std::shared_ptr<StorageNode>> targets;
 
     // 2a) Data-node writes
-    for (int i = 0; i < EC_K; ++i) {
-        const std::string &node = job.data_nodes[i];
-        if (!nodes_.count(node)) continue;
-        StorageService_Stub *stub = nodes_.at(node)->stub.get();
-        write_futures.push_back(
-            std::async(std::launch::async,
-                       &send_one_fragment,
-                       node,
-                       job.file_id,
-                       data_fragments[i],
-                       fragment_len,
-                       stub));
+    for (size_t i = 0; i < job.data_nodes.size(); ++i) {
+        const std::string &name = job.data_nodes[i];
+        auto target = node(name);
+        if (!target) continue;
+        targets.push_back(target);
+        write_calls.emplace_back();
+        write_done.add_count();
+        start_fragment_write(&write_calls.back(), name, job.file_id,
+                             data_fragments[i], fragment_len,
+                             target->stub.get(), -1, &write_done);
     }
 
     // 2b) Parity-node writes
-    for (int i = 0; i < EC_M; ++i) {
-        const std::string &node = job.parity_nodes[i];
-        if (!nodes_.count(node)) continue;
-        StorageService_Stub *stub = nodes_.at(node)->stub.get();
-        write_futures.push_back(
-            std::async(std::launch::async,
-                       &send_one_fragment,
-                       node,
-                       job.file_id,
-                       parity_fragments[i],
-                       fragment_len,
-                       stub));
+    for (size_t i = 0; i < job.parity_nodes.size(); ++i) {
+        const std::string &name = job.parity_nodes[i];
+        auto target = node(name);
+        if (!target) continue;
+        targets.push_back(target);
+        write_calls.emplace_back();
+        write_done.add_count();
+        start_fragment_write(&write_calls.back(), name, job.file_id,
+                             parity_fragments[i], fragment_len,
+                             target->stub.get(), -1, &write_done);
     }
 
     // 3) Wait for all to complete
-    for (auto &fut : write_futures) {
-        WriteResult wr = fut.get();
-        if (!wr.ok) {
-            std::cerr << "Failed to write to node " << wr.node_name
-                      << ": " << wr.error_text << "\n";
+    write_done.wait();
+    for (auto &call : write_calls) {
+        if (call.cntl.Failed()) {
+            std::cerr << "Failed to write to node " << call.node
+                      << ": " << call.cntl.ErrorText() << "\n";
         }
     }
 
     // 4) Cleanup buffers
     int cleanup_res = liberasurecode_encode_cleanup(
-        ec_descriptor_,
+        job.ec_descriptor,
         data_fragments,
         parity_fragments);
     if (cleanup_res != 0) {
@@ -1,59 +1,134 @@
 #pragma once
 
+#include "metadata.pb.h"
+#include "metadata_client.h"
 #include "storage.pb.h"
 #include "status.h"
+#include <atomic>
 #include <brpc/channel.h>
+#include <butil/iobuf.h>
+#include <bvar/latency_recorder.h>
+#include <condition_variable>
 #include <cstdint>
 #include <string>
 #include <sys/types.h>
+#include <map>
+#include <memory>
+#include <shared_mutex>
 #include <unordered_map>
 #include <vector>
 #include <thread>
 #include <mutex>
-#include <future>
-
-#define EC_K 4
-#define EC_M 2
 
 struct StorageNode {
+    std::string address;
+    std::atomic<bool> alive{true}; // As last reported by the metadata service
     brpc::Channel channel;
     std::unique_ptr<StorageService_Stub> stub;
 };
 
 struct WriteJob {
+    int                      ec_descriptor;
     std::vector<std::string> data_nodes;
     std::vector<std::string> parity_nodes;
     std::string              file_id;
     Data                     data_payload; // contains both .payload() and .len()
 };
 
+// Files are striped: they are cut into stripe units of stripe_size() bytes
+// and every unit is erasure-coded on its own into chunk "<file_id>_<stripe>".
+// The data/parity roles rotate over the file's nodes from one stripe to the
+// next, so consecutive stripes are served by different nodes.
+//
+// Storage nodes are not configured on the client: it pulls the node map
+// the nodes registered in from the metadata service, and refreshes it in
+// the background.
 class StorageClient {
   public:
-    StorageClient();
+    StorageClient(std::shared_ptr<MetadataClient> metadata);
     ~StorageClient();
 
-    std::pair<Status, Data> read(
+    // Reads one stripe into dest, which must hold stripe_size(profile)
+    // bytes. Returns the length of the stripe.
+    std::pair<Status, uint64_t> read(
+      const ECProfile &profile,
       const std::vector<std::string> &data_nodes,
       const std::vector<std::string> &parity_nodes,
-      const std::string &file_id
+      const std::string &file_id,
+      uint64_t stripe,
+      char *dest
     );
 
     std::pair<Status, uint64_t> write(
+      const ECProfile &profile,
       const std::vector<std::string> &data_nodes,
       const std::vector<std::string> &parity_nodes,
       const std::string &file_id,
+      uint64_t stripe,
       const Data &data
     );
 
     Status remove_file(
       const std::vector<std::string> &data_nodes,
       const std::vector<std::string> &parity_nodes,
-      const std::string &file_id
+      const std::string &file_id,
+      uint64_t num_stripes
+    );
+
+    // Removes stripes [first_stripe, end_stripe), e.g. the ones past the
+    // end of a truncated file
+    Status remove_stripes(
+      const std::vector<std::string> &data_nodes,
+      const std::vector<std::string> &parity_nodes,
+      const std::string &file_id,
+      uint64_t first_stripe,
+      uint64_t end_stripe
     );
 
+    // The profile's, which the metadata service sets on every new file;
+    // --stripe_size only for files created before it did
+    uint64_t stripe_size(const ECProfile &profile) const;
+
+    // EC profiles as text, "k=4,m=2[,backend=<name>][,stripe_size=<bytes>]"
+    static Status parse_profile(const std::string &text, ECProfile *profile);
+    static std::string format_profile(const ECProfile &profile);
+    static Status validate_profile(const ECProfile &profile);
+
   private:
-    std::unordered_map<std::string, std::unique_ptr<StorageNode>> nodes_;
-    int ec_descriptor_;
+    std::shared_ptr<MetadataClient> metadata_;
+
+    // Node map, by node name. Calls hold on to their StorageNode, so a
+    // refresh can drop a node while requests to it are in flight.
+    std::shared_mutex nodes_mu_;
+    std::unordered_map<std::string, std::shared_ptr<StorageNode>> nodes_;
+    uint64_t node_map_version_ = 0;
+
+    std::thread refresher_;
+    std::mutex refresher_mu_;
+    std::condition_variable refresher_cv_;
+    bool stopping_ = false;
+
+    // liberasurecode instances, one per "<backend>:<k>:<m>", created on
+    // first use
+    std::mutex ec_mu_;
+    std::map<std::string, int> ec_instances_;
+    // Latency of successful fragment reads, drives the hedge delay
+    bvar::LatencyRecorder fragment_latency_;
+
+    Status refresh_nodes();
+    void refresh_loop();
+    // Looks a node up, refreshing the node map once if it is unknown.
+    // Returns nullptr if the node isn't registered.
+    std::shared_ptr<StorageNode> node(const std::string &name);
+
+    int64_t hedge_delay_us() const;
+    std::pair<Status, int> ec_instance(const ECProfile &profile);
 
     void process_write(const WriteJob &job);
+    void place_stripe(const std::vector<std::string> &data_nodes,
+                      const std::vector<std::string> &parity_nodes,
+                      uint64_t stripe,
+                      std::vector<std::string> *stripe_data_nodes,
+                      std::vector<std::string> *stripe_parity_nodes) const;
+    static std::string stripe_id(const std::string &file_id, uint64_t stripe);
 };
@@ -1,13 +1,17 @@
 #include "storage_engine.h"
 #include "directory.h"
 #include "file_handle.h"
-#include "fuse.h"
 #include "status.h"
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <gflags/gflags.h>
 #include <memory>
 
+DEFINE_uint32(readdir_page_size, 1024,
+              "Number of directory entries fetched per metadata RPC while "
+              "listing a directory");
+
 Status StorageEngine::init() {
     // Initialize the root directory
     Status s = root_->init();
@@ -15,18 +19,106 @@ Status StorageEngine::init() {
         return s;
     }
 
+    // The kernel holds the root from mount to unmount, it is never forgotten
+    remember(FUSE_ROOT_ID, nullptr, root_.get());
+
     start_prefetcher();
 
     return Status::OK();
 }
 
-Status StorageEngine::open(const std::string &path, int flags, 
-                           FilePointer **out_fp) {
-    auto [s, fh] = find_file(path);
+Status StorageEngine::lookup(fuse_ino_t parent, const std::string &name,
+                             struct stat *stbuf) {
+    std::shared_lock tree_lk(tree_mu_);
+
+    // A hot name resolves to an inode the kernel still holds without going
+    // through its directory, and a missing one without asking the metadata
+    // service again
+    std::shared_ptr<FileHandle> fh;
+    Directory *dir = nullptr;
+    uint64_t cached;
+    if (dentries_.lookup(parent, name, &cached)) {
+        if (cached == 0) {
+            return Status::NotFound("File or directory not found");
+        }
+        fh = get_file(cached);
+        dir = fh ? nullptr : get_dir(cached);
+    }
+
+    if (!fh && !dir) {
+        Directory *parent_dir = get_dir(parent);
+        if (!parent_dir) {
+            return Status::NotFound("Parent directory not found");
+        }
+        Status s = parent_dir->load(name);
+        if (s.is_not_found()) {
+            dentries_.insert_negative(parent, name);
+            return s;
+        } else if (!s.ok()) {
+            return s;
+        }
+        fh = parent_dir->get_file(name);
+        dir = fh ? nullptr : parent_dir->get_dir(name);
+        if (!fh && !dir) {
+            return Status::NotFound("File or directory not found");
+        }
+        dentries_.insert(parent, name,
+                         fh ? fh->get_inode() : dir->get_inode());
+    }
+
+    if (fh) {
+        Status s = fh->getattr(stbuf);
+        if (!s.ok()) {
+            return s;
+        }
+        remember(fh->get_inode(), fh, nullptr);
+    } else {
+        Status s = dir->getattr(stbuf);
+        if (!s.ok()) {
+            return s;
+        }
+        remember(dir->get_inode(), nullptr, dir);
+    }
+    return Status::OK();
+}
+
+void StorageEngine::forget(fuse_ino_t ino, uint64_t nlookup) {
+    if (ino == FUSE_ROOT_ID) {
+        return;
+    }
+    std::unique_lock tree_lk(tree_mu_);
+    Inode entry;
+    {
+        std::unique_lock lk(inodes_mu_);
+        auto it = inodes_.find(ino);
+        if (it == inodes_.end()) {
+            return;
+        }
+        if (it->second.nlookup > nlookup) {
+            it->second.nlookup -= nlookup;
+            return;
+        }
+        entry = std::move(it->second);
+        inodes_.erase(it);
+    }
+
+    // The kernel no longer knows the entry, so unless it is in use it can
+    // leave memory too
+    uint64_t parent = entry.fh ? entry.fh->get_parent_inode()
+                               : entry.dir->get_parent_inode();
+    std::string name = entry.fh ? entry.fh->get_name() : entry.dir->get_name();
+    if (Directory *dir = get_dir(parent)) {
+        dir->evict(name, ino);
+    }
+}
+
+Status StorageEngine::open(fuse_ino_t ino, int flags, FilePointer **out_fp,
+                           bool *keep_cache) {
+    auto fh = get_file(ino);
     if (!fh) {
         return Status::NotFound("File not found");
     }
-    s = fh->open(out_fp, flags);
+    Status s = fh->open(out_fp, flags, keep_cache);
     if (!s.ok()) {
         return s;
     }
@@ -41,24 +133,38 @@ Status StorageEngine::open(const std::string &path, int flags,
     return Status::OK();
 }
 
-Status StorageEngine::create(const std::string &path) {
-    auto [dir_name, file_name] = split_path_from_target(path);
-    if (file_name.empty()) {
-        return Status::InvalidArgument("Invalid path");
+Status StorageEngine::create(fuse_ino_t parent, const std::string &name,
+                             int flags, FilePointer **out_fp,
+                             struct stat *stbuf) {
+    if (name.empty()) {
+        return Status::InvalidArgument("Invalid name");
     }
 
-    auto [s, parent_dir] = find_dir(dir_name);
-    if (!s.ok()) {
-        return s;
+    Directory *parent_dir = get_dir(parent);
+    if (!parent_dir) {
+        return Status::NotFound("Parent directory not found");
     }
 
-    if (parent_dir->get_file(file_name)) {
+    if (parent_dir->get_file(name)) {
         return Status::AlreadyExists("File already exists");
     }
 
-    auto [s1, fh] = parent_dir->create_file(file_name);
+    auto [s, fh] = parent_dir->create_file(name);
+    if (!s.ok()) {
+        return s;
+    }
 
-    return s1;
+    s = fh->getattr(stbuf);
+    if (!s.ok()) {
+        return s;
+    }
+    s = fh->open(out_fp, flags);
+    if (!s.ok()) {
+        return s;
+    }
+    dentries_.insert(parent, name, fh->get_inode());
+    remember(fh->get_inode(), fh, nullptr);
+    return Status::OK();
 }
 
 Status StorageEngine::close(FilePointer *fp) {
@@ -70,15 +176,19 @@ Status StorageEngine::close(FilePointer *fp) {
 
     if (fh->is_unlinked()) {
         // If the file is unlinked, we can remove it from the parent directory
-        std::string path = fh->get_logic_path();
-        auto [dir_name, file_name] = split_path_from_target(path);
-        auto [dir_status, directory] = find_dir(dir_name);
-        if (!dir_status.ok()) {
-            return dir_status;
+        Directory *directory = get_dir(fh->get_parent_inode());
+        if (!directory) {
+            auto [dir_name, file_name] =
+                split_path_from_target(fh->get_logic_path());
+            auto [dir_status, dir] = find_dir(dir_name);
+            if (!dir_status.ok()) {
+                return dir_status;
+            }
+            directory = dir;
         }
 
         // Remove the file from the directory
-        auto [s2, fh] = directory->remove_file(file_name);
+        auto [s2, removed] = directory->remove_file(fh->get_name());
         if (!s2.ok()) {
             return s2;
         }
@@ -87,20 +197,22 @@ Status StorageEngine::close(FilePointer *fp) {
     return Status::OK();
 }
 
-Status StorageEngine::unlink(const std::string path) {
-    auto [dir_name, file_name] = split_path_from_target(path);
-
-    auto [dir_status, directory] = find_dir(dir_name);
-    if (!dir_status.ok()) {
-        return dir_status;
+Status StorageEngine::unlink(fuse_ino_t parent, const std::string &name) {
+    Directory *directory = get_dir(parent);
+    if (!directory) {
+        return Status::NotFound("Parent directory not found");
     }
 
-    auto fh = directory->get_file(file_name);
+    auto fh = directory->get_file(name);
+    if (!fh) {
+        return Status::NotFound("File not found");
+    }
+    dentries_.erase(parent, name);
     fh->unlink();
 
     if (fh->is_unlinked()) {
         // If the file is unlinked, we can remove it from the parent directory
-        auto [s, _fh] = directory->remove_file(file_name);
+        auto [s, _fh] = directory->remove_file(name);
         if (!s.ok()) {
             return s;
         }
@@ -109,201 +221,238 @@ Status StorageEngine::unlink(const std::string path) {
     return Status::OK();
 }
 
-Status StorageEngine::read(FilePointer *fp, Slice result, size_t size,
-                           off_t offset) {
+Status StorageEngine::read_buf(FilePointer *fp, size_t size, off_t offset,
+                               struct fuse_bufvec *buf) {
     std::shared_ptr<FileHandle> fh = fp->fh;
 
-    Status s = fh->read(fp, result, size, offset);
+    Status s = fh->prepare_read(size, offset);
     if (!s.ok()) {
         return s;
     }
 
+    *buf = FUSE_BUFVEC_INIT(size);
+    buf->buf[0].flags =
+        static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+    buf->buf[0].fd = fp->fd;
+    buf->buf[0].pos = offset;
+
     return Status::OK();
 }
 
-Status StorageEngine::write(FilePointer *fp, Slice data, size_t size,
-                            off_t offset) {
+Status StorageEngine::write_buf(FilePointer *fp, struct fuse_bufvec *src,
+                                off_t offset, size_t *written) {
     std::shared_ptr<FileHandle> fh = fp->fh;
-    Status s = fh->write(fp, data, size, offset);
+
+    size_t size = fuse_buf_size(src);
+    Status s = fh->write(fp, size, offset, [&](int fd) {
+        struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+        dst.buf[0].flags =
+            static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+        dst.buf[0].fd = fd;
+        dst.buf[0].pos = offset;
+        return fuse_buf_copy(&dst, src, static_cast<fuse_buf_copy_flags>(0));
+    });
     if (!s.ok()) {
         return s;
     }
 
+    *written = size;
     return Status::OK();
 }
 
-Status StorageEngine::sync(std::string path) {
-    auto [s, fh] = find_file(path);
-    if (!s.ok()) {
-        return s;
+Status StorageEngine::sync(fuse_ino_t ino) {
+    auto fh = get_file(ino);
+    if (!fh) {
+        return Status::NotFound("File not found");
     }
     return fh->sync();
 }
 
-Status StorageEngine::rename(const std::string &src_path,
-                             const std::string &dst_path) {
-    auto [src_parent_path, src_name] = split_path_from_target(src_path);
-    auto [dst_parent_path, dst_name] = split_path_from_target(dst_path);
-
-    if (is_file(src_path)) {
-        if (src_name.empty() || dst_name.empty()) {
-            return Status::InvalidArgument("Invalid path");
-        }
-
-        // Get the parent directories
-        auto [src_dir_status, src_parent_dir] = find_dir(src_parent_path);
-        if (!src_dir_status.ok()) {
-            return src_dir_status;
-        }
-
-        auto [dst_dir_status, dst_parent_dir] = find_dir(dst_parent_path);
-        if (!dst_dir_status.ok()) {
-            return dst_dir_status;
-        }
-
-        std::shared_ptr<FileHandle> file_handle =
-            src_parent_dir->get_file(src_name);
-        if (!file_handle) {
-            return Status::NotFound("File not found");
-        }
-
-        Status rename_status =
-            dst_parent_dir->move_file(src_parent_dir, file_handle, dst_name);
-        if (!rename_status.ok()) {
-            return rename_status;
-        }
-
-        return Status::OK();
-    } else if (is_dir(src_path)) {
-        if (src_name.empty() || dst_name.empty()) {
-            return Status::InvalidArgument("Invalid path");
-        }
-
-        auto [src_parent_status, src_parent_directory] =
-            find_dir(src_parent_path);
-        if (!src_parent_status.ok()) {
-            return src_parent_status;
-        }
-
-        auto [dst_parent_status, dst_parent_directory] =
-            find_dir(dst_parent_path);
-        if (!dst_parent_status.ok()) {
-            return dst_parent_status;
-        }
-
-        auto [remove_dir_status, directory_to_move] =
-            src_parent_directory->remove_dir(src_name, false);
-        if (!remove_dir_status.ok()) {
-            return remove_dir_status;
-        }
+Status StorageEngine::rename(fuse_ino_t parent, const std::string &name,
+                             fuse_ino_t newparent,
+                             const std::string &newname) {
+    if (name.empty() || newname.empty()) {
+        return Status::InvalidArgument("Invalid name");
+    }
 
-        Status rename_dir_status = dst_parent_directory->move_dir(
-            src_parent_directory, std::move(directory_to_move), dst_name);
-        if (!rename_dir_status.ok()) {
-            return rename_dir_status;
-        }
+    // Get the parent directories
+    Directory *src_parent_dir = get_dir(parent);
+    Directory *dst_parent_dir = get_dir(newparent);
+    if (!src_parent_dir || !dst_parent_dir) {
+        return Status::NotFound("Parent directory not found");
+    }
 
-        return Status::OK();
+    dentries_.erase(parent, name);
+    dentries_.erase(newparent, newname);
+    if (auto file_handle = src_parent_dir->get_file(name)) {
+        return dst_parent_dir->move_file(src_parent_dir, file_handle, newname);
+    }
+    if (auto directory = src_parent_dir->get_dir(name)) {
+        return dst_parent_dir->move_dir(src_parent_dir, directory, newname);
     }
 
     return Status::NotFound("File or directory not found");
 }
 
-Status StorageEngine::mkdir(const std::string &path) {
-    auto [dir_name, new_dir_name] = split_path_from_target(path);
-    if (new_dir_name.empty()) {
-        return Status::InvalidArgument("Invalid path");
+Status StorageEngine::mkdir(fuse_ino_t parent, const std::string &name,
+                            struct stat *stbuf) {
+    if (name.empty()) {
+        return Status::InvalidArgument("Invalid name");
     }
 
     // Get the parent directory
-    auto [s, parent_dir] = find_dir(dir_name);
-    if (!s.ok()) {
-        return s;
+    Directory *parent_dir = get_dir(parent);
+    if (!parent_dir) {
+        return Status::NotFound("Parent directory not found");
     }
 
     // Check if the directory already exists
-    auto dir = parent_dir->get_dir(new_dir_name);
-    if (dir) {
+    if (parent_dir->get_dir(name)) {
         return Status::AlreadyExists("Directory already exists");
     }
 
     // Create the new directory
-    auto [s1, _dir] = parent_dir->create_subdirectory(new_dir_name);
-    return s1;
+    auto [s, dir] = parent_dir->create_subdirectory(name);
+    if (!s.ok()) {
+        return s;
+    }
+
+    s = dir->getattr(stbuf);
+    if (!s.ok()) {
+        return s;
+    }
+    dentries_.insert(parent, name, dir->get_inode());
+    remember(dir->get_inode(), nullptr, dir);
+    return Status::OK();
 }
 
-Status StorageEngine::rmdir(const std::string &path) {
-    auto [dir_name, target] = split_path_from_target(path);
-    auto [s, parent_dir] = find_dir(dir_name);
-    if (target.empty() || !s.ok()) {
+Status StorageEngine::rmdir(fuse_ino_t parent, const std::string &name) {
+    Directory *parent_dir = get_dir(parent);
+    if (name.empty() || !parent_dir) {
         return Status::InvalidArgument("Invalid path");
     }
 
     // Check if the directory exists
-    auto subdir = parent_dir->get_dir(target);
+    auto subdir = parent_dir->get_dir(name);
     if (!subdir) {
         return Status::NotFound("Directory not found");
     }
+    if (!subdir->empty()) {
+        return Status::NotEmpty("Directory not empty");
+    }
 
-    auto [s1, dir] = parent_dir->remove_dir(target);
-    return s1;
+    // The Directory is freed with its entry in the parent, so it can't stay
+    // reachable through the inode table
+    dentries_.erase(parent, name);
+    drop(subdir->get_inode());
+    auto [s, dir] = parent_dir->remove_dir(name);
+    return s;
 }
 
-Status StorageEngine::getattr(const std::string &path, struct stat *stbuf) {
-    struct stat *buf = new struct stat();
-    if (is_file(path)) {
-        auto [s, fh] = find_file(path);
-        if (!s.ok()) {
-            return s;
-        }
-        fh->getattr(buf);
-    } else if (is_dir(path)) {
-        auto [s, dir] = find_dir(path);
-        if (!s.ok()) {
-            return s;
-        }
-        dir->getattr(buf);
-    } else {
-        return Status::NotFound("File or directory not found");
+Status StorageEngine::getattr(fuse_ino_t ino, struct stat *stbuf) {
+    if (auto fh = get_file(ino)) {
+        return fh->getattr(stbuf);
     }
+    if (auto dir = get_dir(ino)) {
+        return dir->getattr(stbuf);
+    }
+    return Status::NotFound("File or directory not found");
+}
 
-    if (!buf) {
-        return Status::IOError("Failed to get directory metadata");
+Status StorageEngine::opendir(fuse_ino_t ino, DirCursor **out_cursor) {
+    Directory *dir = get_dir(ino);
+    if (!dir) {
+        return Status::NotFound("Directory not found");
     }
 
-    memcpy(stbuf, buf, sizeof(struct stat));
-    delete buf;
+    auto cursor = std::make_unique<DirCursor>();
+    cursor->ino = ino;
+    first_page(dir, cursor.get());
+    *out_cursor = cursor.release();
     return Status::OK();
 }
 
-Status StorageEngine::readdir(const std::string &path, void *buf,
-                              fuse_fill_dir_t filler,
-                              fuse_readdir_flags flags) {
-    auto [s, dir] = find_dir(path);
-    if (!s.ok()) {
+Status StorageEngine::readdir(
+    DirCursor *cursor, off_t off, bool plus,
+    const std::function<bool(const DirEntry &, off_t)> &emit) {
+    std::shared_lock tree_lk(tree_mu_);
+    Directory *dir = get_dir(cursor->ino);
+    if (!dir) {
         return Status::NotFound("Directory not found");
     }
 
-    return dir->readdir(buf, filler, flags);
-}
+    std::lock_guard lk(cursor->mu);
+    if (off < cursor->start) {
+        // Rewound, e.g. by rewinddir()
+        first_page(dir, cursor);
+    }
 
-Status StorageEngine::utimens(const std::string &path,
-                              const struct timespec tv[2]) {
-    // check if is file or directory
-    if (is_file(path)) {
-        auto [s, fh] = find_file(path);
-        if (!s.ok()) {
-            return s;
+    while (true) {
+        size_t i = off - cursor->start;
+        if (i >= cursor->entries.size()) {
+            if (!cursor->more) {
+                break;
+            }
+            // The cursor is left on the current page when the next one
+            // can't be fetched, so that the stream can go on from off
+            std::vector<DirEntry> page;
+            bool more = false;
+            Status s = dir->readdir(cursor->last, FLAGS_readdir_page_size,
+                                    plus, &page, &more);
+            if (!s.ok()) {
+                return s;
+            }
+            cursor->start += cursor->entries.size();
+            cursor->entries = std::move(page);
+            cursor->more = more;
+            if (!cursor->entries.empty()) {
+                cursor->last = cursor->entries.back().name;
+            }
+            continue;
         }
-        return fh->utimens(tv);
-    } else if (is_dir(path)) {
-        auto [s, dir] = find_dir(path);
-        if (!s.ok()) {
-            return s;
+
+        const DirEntry &entry = cursor->entries[i];
+        if (!emit(entry, off + 1)) {
+            break;
+        }
+        off++;
+        if (!plus || entry.name == "." || entry.name == "..") {
+            continue;
+        }
+        if (auto fh = dir->get_file(entry.name)) {
+            remember(fh->get_inode(), fh, nullptr);
+        } else if (auto child = dir->get_dir(entry.name)) {
+            remember(child->get_inode(), nullptr, child);
         }
-        return dir->utimens(tv);
     }
+    return Status::OK();
+}
+
+void StorageEngine::releasedir(DirCursor *cursor) { delete cursor; }
+
+void StorageEngine::first_page(Directory *dir, DirCursor *cursor) {
+    fuse_ino_t parent =
+        cursor->ino == FUSE_ROOT_ID ? cursor->ino : dir->get_parent_inode();
+    cursor->entries.clear();
+    for (auto [name, ino] : {std::pair<const char *, fuse_ino_t>{".", cursor->ino},
+                             {"..", parent}}) {
+        DirEntry entry{name, ino, S_IFDIR, {}};
+        entry.attr.st_ino = ino;
+        entry.attr.st_mode = S_IFDIR;
+        cursor->entries.push_back(std::move(entry));
+    }
+    cursor->start = 0;
+    cursor->last.clear();
+    cursor->more = true;
+}
 
+Status StorageEngine::utimens(fuse_ino_t ino, const struct timespec tv[2]) {
+    if (auto fh = get_file(ino)) {
+        return fh->utimens(tv);
+    }
+    if (auto dir = get_dir(ino)) {
+        return dir->utimens(tv);
+    }
     return Status::NotFound("File or directory not found");
 }
 
@@ -312,65 +461,82 @@ Status StorageEngine::lseek(FilePointer *fp, off_t offset, int whence, off_t *ne
     return fh->lseek(fp, offset, whence, new_offset);
 }
 
-std::string StorageEngine::get_logic_path(const std::string &path) {
-    if (path == mount_path_) {
-        return "/";
-    }
-
-    return path.substr(mount_path_.size());
-}
+// Extended attribute holding the EC profile of a file or directory, in the
+// text form of StorageClient::parse_profile()
+static const std::string kECProfileXattr = "user.torchfs.ec_profile";
 
-bool StorageEngine::is_file(const std::string &path) {
-    if (path == "/") {
-        return false;
+Status StorageEngine::setxattr(fuse_ino_t ino, const std::string &name,
+                               const std::string &value) {
+    if (name != kECProfileXattr) {
+        return Status::InvalidArgument("Unsupported extended attribute");
     }
-    auto [dir_name, target] = split_path_from_target(path);
-    auto [s, parent_dir] = find_dir(dir_name);
-    if (target.empty() || !s.ok()) {
-        return false;
+    ECProfile profile;
+    Status s = StorageClient::parse_profile(value, &profile);
+    if (!s.ok()) {
+        return s;
     }
 
-    auto fh = parent_dir->get_file(target);
-    if (!fh) {
-        return false;
+    if (auto fh = get_file(ino)) {
+        return fh->set_ec_profile(profile);
     }
-
-    return true;
+    if (auto dir = get_dir(ino)) {
+        return dir->set_ec_profile(profile);
+    }
+    return Status::NotFound("File or directory not found");
 }
 
-bool StorageEngine::is_dir(const std::string &path) {
-    if (path == "/") {
-        return true;
+Status StorageEngine::getxattr(fuse_ino_t ino, const std::string &name,
+                               std::string *value) {
+    if (name != kECProfileXattr) {
+        return Status::NotFound("No such extended attribute");
     }
-    auto [dir_name, target] = split_path_from_target(path);
-    auto [s, parent_dir] = find_dir(dir_name);
-    if (target.empty() || !s.ok()) {
-        return false;
+
+    std::pair<Status, ECProfile> result;
+    if (auto fh = get_file(ino)) {
+        result = fh->get_ec_profile();
+    } else if (auto dir = get_dir(ino)) {
+        result = dir->get_ec_profile();
+    } else {
+        return Status::NotFound("File or directory not found");
     }
-    // Check if the target is a directory
-    auto subdir = parent_dir->get_dir(target);
-    if (!subdir) {
-        return false;
+
+    if (!result.first.ok()) {
+        return result.first;
     }
+    *value = StorageClient::format_profile(result.second);
+    return Status::OK();
+}
 
-    return true;
+void StorageEngine::remember(fuse_ino_t ino, std::shared_ptr<FileHandle> fh,
+                             Directory *dir) {
+    std::unique_lock lk(inodes_mu_);
+    Inode &entry = inodes_[ino];
+    entry.fh = std::move(fh);
+    entry.dir = dir;
+    entry.nlookup++;
 }
 
-std::pair<Status, std::shared_ptr<FileHandle>>
-StorageEngine::find_file(const std::string &path) {
-    if (path == "/") {
-        return {Status::InvalidArgument("Invalid path"), nullptr};
-    }
-    auto [dir_name, file_name] = split_path_from_target(path);
-    auto [s, parent_dir] = find_dir(dir_name);
-    if (!s.ok()) {
-        return {s, nullptr};
+void StorageEngine::drop(fuse_ino_t ino) {
+    std::unique_lock lk(inodes_mu_);
+    inodes_.erase(ino);
+}
+
+std::shared_ptr<FileHandle> StorageEngine::get_file(fuse_ino_t ino) {
+    std::shared_lock lk(inodes_mu_);
+    auto it = inodes_.find(ino);
+    if (it == inodes_.end()) {
+        return nullptr;
     }
-    auto fh = parent_dir->get_file(file_name);
-    if (!fh) {
-        return {Status::NotFound("File not found"), nullptr};
+    return it->second.fh;
+}
+
+Directory *StorageEngine::get_dir(fuse_ino_t ino) {
+    std::shared_lock lk(inodes_mu_);
+    auto it = inodes_.find(ino);
+    if (it == inodes_.end()) {
+        return nullptr;
     }
-    return {Status::OK(), fh};
+    return it->second.dir;
 }
 
 std::pair<Status, Directory *>
@@ -425,10 +591,15 @@ void StorageEngine::prefetch_loop() {
         prefetch_queue_.pop_front();
         lk.unlock();
 
-        auto [dir_name, file_name] = split_path_from_target(fh->get_logic_path());
-        auto [s, parent_dir] = find_dir(dir_name);
-        if (!s.ok()) {
-            continue;
+        Directory *parent_dir = get_dir(fh->get_parent_inode());
+        if (!parent_dir) {
+            auto [dir_name, file_name] =
+                split_path_from_target(fh->get_logic_path());
+            auto [s, dir] = find_dir(dir_name);
+            if (!s.ok()) {
+                continue;
+            }
+            parent_dir = dir;
         }
         auto files = parent_dir->list_files();
         int index = -1;
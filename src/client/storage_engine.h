@@ -3,59 +3,119 @@
 
 #include "directory.h"
 #include "file_handle.h"
-#include "fuse.h"
+#include "fuse_lowlevel.h"
 #include "status.h"
 #include "cache.h"
+#include "dentry_cache.h"
 #include "cache_policies/fifo_policy.h"
 
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+// Position of an open directory stream: the page of entries it read last
+struct DirCursor {
+    fuse_ino_t ino;
+    std::mutex mu;
+    std::vector<DirEntry> entries; // Current page
+    off_t start = 0;               // Offset of entries[0] in the stream
+    std::string last;              // Name the next page starts after
+    bool more = true;              // Pages follow the current one
+};
 
 class StorageEngine {
   public:
     StorageEngine(const std::string &mount_path)
         : mount_path_(mount_path),
-          root_(std::make_unique<Directory>(
-              0, 1, "/", mount_path,
-              std::make_shared<MetadataClient>(),
-              std::make_shared<StorageClient>())),
-          cache_(std::make_unique<FIFOEvictionPolicy>()) {}
+          cache_(std::make_unique<FIFOEvictionPolicy>()) {
+        // The storage client pulls its node map from the metadata service
+        auto metadata = std::make_shared<MetadataClient>();
+        root_ = std::make_unique<Directory>(
+            0, 1, "/", mount_path, metadata,
+            std::make_shared<StorageClient>(metadata));
+    }
 
     ~StorageEngine() {}
 
     Status init();
 
-    Status open(const std::string &path, int flagse, FilePointer **out_fp);
-    Status create(const std::string &path);
+    // Operations are addressed by inode, the FUSE inode number of an entry
+    // being its TorchFS inode. lookup(), create() and mkdir() hand out a
+    // reference to the entry they return, which forget() gives back.
+    Status lookup(fuse_ino_t parent, const std::string &name,
+                  struct stat *stbuf);
+    void forget(fuse_ino_t ino, uint64_t nlookup);
+    // keep_cache is set when the kernel may keep its cached pages of the file
+    Status open(fuse_ino_t ino, int flags, FilePointer **out_fp,
+                bool *keep_cache);
+    Status create(fuse_ino_t parent, const std::string &name, int flags,
+                  FilePointer **out_fp, struct stat *stbuf);
     Status close(FilePointer *fp);
-    Status unlink(const std::string path);
-    Status read(FilePointer *fp, Slice result, size_t size, off_t offset);
-    Status write(FilePointer *fp, Slice data, size_t size, off_t offset);
-    Status sync(std::string path);
-    Status rename(const std::string &oldpath, const std::string &newpath);
-    Status getattr(const std::string &path, struct stat *stbuf);
-    Status readdir(const std::string &path, void *buf, fuse_fill_dir_t filler,
-                   fuse_readdir_flags flags);
-    Status mkdir(const std::string &path);
-    Status rmdir(const std::string &path);
-    Status utimens(const std::string &path, const struct timespec tv[2]);
+    Status unlink(fuse_ino_t parent, const std::string &name);
+    // Data moves between the kernel and the local cache file as fuse_bufvecs
+    // pointing at the file's descriptor, which libfuse can splice without
+    // copying it through userspace
+    Status read_buf(FilePointer *fp, size_t size, off_t offset,
+                    struct fuse_bufvec *buf);
+    Status write_buf(FilePointer *fp, struct fuse_bufvec *src, off_t offset,
+                     size_t *written);
+    Status sync(fuse_ino_t ino);
+    Status rename(fuse_ino_t parent, const std::string &name,
+                  fuse_ino_t newparent, const std::string &newname);
+    Status getattr(fuse_ino_t ino, struct stat *stbuf);
+    // A directory stream lists ".", ".." and the entries of a directory.
+    // readdir() passes the entries from offset off on to emit, with the
+    // offset of the next one, until it returns false. They are fetched from
+    // the metadata service a page at a time, as the stream is read. With
+    // plus, each entry emit takes but "." and ".." counts as a lookup, the
+    // kernel caches them like lookup() results. When a page can't be
+    // fetched, the entries emitted before it stay emitted.
+    Status opendir(fuse_ino_t ino, DirCursor **out_cursor);
+    Status readdir(DirCursor *cursor, off_t off, bool plus,
+                   const std::function<bool(const DirEntry &, off_t)> &emit);
+    void releasedir(DirCursor *cursor);
+    Status mkdir(fuse_ino_t parent, const std::string &name,
+                 struct stat *stbuf);
+    Status rmdir(fuse_ino_t parent, const std::string &name);
+    Status utimens(fuse_ino_t ino, const struct timespec tv[2]);
     Status lseek(FilePointer *fp, off_t offset, int whence, off_t *new_offset);
-
-    std::string get_logic_path(const std::string &path);
+    Status setxattr(fuse_ino_t ino, const std::string &name,
+                    const std::string &value);
+    Status getxattr(fuse_ino_t ino, const std::string &name,
+                    std::string *value);
 
   private:
+    // An entry of the inode table: the file or directory behind an inode
+    // the kernel knows about, and how many lookups it holds on it
+    struct Inode {
+        std::shared_ptr<FileHandle> fh; // Set for files
+        Directory *dir = nullptr;       // Set for directories, owned by the tree
+        uint64_t nlookup = 0;
+    };
+
     std::string mount_path_;          // Directory for local storage
     std::unique_ptr<Directory> root_; // Root directory
     Cache cache_;
 
-    std::string register_fh(std::shared_ptr<FileHandle> fh);
-    std::shared_ptr<FileHandle> lookup_fh(std::string &logic_path);
-    std::shared_ptr<FileHandle> get_file_handle(std::string file_path);
+    // Entries are loaded into the tree as they are looked up, and leave it
+    // when forgotten. Held shared from finding an entry in its directory
+    // until it is remembered, so that it can't be evicted meanwhile.
+    std::shared_mutex tree_mu_;
+    std::shared_mutex inodes_mu_;
+    std::unordered_map<fuse_ino_t, Inode> inodes_;
+    DentryCache dentries_;
+
+    void remember(fuse_ino_t ino, std::shared_ptr<FileHandle> fh,
+                  Directory *dir);
+    void drop(fuse_ino_t ino);
+    std::shared_ptr<FileHandle> get_file(fuse_ino_t ino);
+    Directory *get_dir(fuse_ino_t ino);
 
-    std::pair<Status, std::shared_ptr<FileHandle>>
-    find_file(const std::string &path);
     std::pair<Status, Directory *> find_dir(const std::string &path);
-    bool is_file(const std::string &path);
-    bool is_dir(const std::string &path);
+    // Rewinds a directory stream to ".", ".."
+    void first_page(Directory *dir, DirCursor *cursor);
 
     // A background thread to drain a job queue:
     std::thread prefetch_thread_;
@@ -1,272 +1,490 @@
 #include "torch_fuse.h"
-#include "slice.h"
 #include "status.h"
 #include "storage_engine.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <fcntl.h>
+#include <gflags/gflags.h>
 #include <iostream>
 #include <ostream>
+#include <string>
 #include <sys/types.h>
+#include <vector>
+
+DEFINE_double(entry_timeout, 1.0,
+              "Seconds the kernel caches the result of a lookup");
+DEFINE_double(attr_timeout, 1.0,
+              "Seconds the kernel caches the attributes of an entry");
+DEFINE_double(negative_timeout, 0.0,
+              "Seconds the kernel caches that a name doesn't exist, 0 to "
+              "disable");
+DEFINE_bool(auto_cache, true,
+            "Keep the kernel page cache of a file across opens while its "
+            "modification time and size don't change");
+DEFINE_uint32(max_write, 1024 * 1024,
+              "Maximum size of a write request in bytes");
+DEFINE_uint32(max_background, 64,
+              "Maximum number of background requests, like readahead, the "
+              "kernel keeps outstanding");
+DEFINE_bool(writeback_cache, false,
+            "Let the kernel buffer writes and send them in large batches");
+DEFINE_bool(splice, true,
+            "Move file data between the kernel and the local cache with "
+            "splice(2) instead of copying it through userspace");
+DEFINE_bool(kernel_cache, false,
+            "Always keep the kernel page cache of a file across opens, for "
+            "data that is never changed by another client");
+
+// Whether the kernel agreed to cache writes, set in init
+static bool writeback = false;
+
+static StorageEngine *engine(fuse_req_t req) {
+    return static_cast<StorageEngine *>(fuse_req_userdata(req));
+}
 
-// Removed static for external linkage.
-int torch_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                  off_t /*offset*/, struct fuse_file_info * /*fi*/,
-                  fuse_readdir_flags flags) {
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    Status s = se->readdir(se->get_logic_path(path), buf, filler, flags);
+static int status_to_errno(const Status &s) {
+    if (s.is_not_found()) {
+        return ENOENT;
+    } else if (s.is_already_exists()) {
+        return EEXIST;
+    } else if (s.is_invalid_argument()) {
+        return EINVAL;
+    } else if (s.is_not_empty()) {
+        return ENOTEMPTY;
+    }
+    return EIO;
+}
+
+// With writeback caching the kernel also reads from files opened write
+// only, to fill partial pages, and it positions appends itself
+static int open_flags(int flags) {
+    if (writeback) {
+        if ((flags & O_ACCMODE) == O_WRONLY) {
+            flags = (flags & ~O_ACCMODE) | O_RDWR;
+        }
+        flags &= ~O_APPEND;
+    }
+    return flags;
+}
+
+static void reply_entry(fuse_req_t req, const struct stat &st) {
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.ino = st.st_ino;
+    e.attr = st;
+    e.attr_timeout = FLAGS_attr_timeout;
+    e.entry_timeout = FLAGS_entry_timeout;
+    fuse_reply_entry(req, &e);
+}
+
+void torch_init(void * /*userdata*/, struct fuse_conn_info *conn) {
+    // Let the kernel drop the cached pages of an open file when getattr
+    // reports a new modification time, the counterpart of keep_cache on open
+    if (FLAGS_auto_cache && (conn->capable & FUSE_CAP_AUTO_INVAL_DATA)) {
+        conn->want |= FUSE_CAP_AUTO_INVAL_DATA;
+    }
+    // Large requests mean fewer round trips per sample. libfuse lowers
+    // max_write to what its buffers can hold.
+    conn->max_write = FLAGS_max_write;
+    if (FLAGS_max_background > 0) {
+        conn->max_background = FLAGS_max_background;
+        conn->congestion_threshold = FLAGS_max_background * 3 / 4;
+    }
+    // With writeback caching the kernel owns size and mtime while the file
+    // is open, it sends them with setattr and flushes on close and fsync
+    if (FLAGS_writeback_cache && (conn->capable & FUSE_CAP_WRITEBACK_CACHE)) {
+        conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+        writeback = true;
+    }
+    // Listings carry the attributes of the entries, so that ls -l or
+    // os.scandir() don't stat each one afterwards
+    if (conn->capable & FUSE_CAP_READDIRPLUS) {
+        conn->want |= FUSE_CAP_READDIRPLUS;
+    }
+    // libfuse asks for splice reads by itself when write_buf is set
+    if (FLAGS_splice) {
+        conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ |
+                                       FUSE_CAP_SPLICE_WRITE |
+                                       FUSE_CAP_SPLICE_MOVE);
+    } else {
+        conn->want &= ~FUSE_CAP_SPLICE_READ;
+    }
+    std::cout << "[INFO] Kernel cache: entry_timeout=" << FLAGS_entry_timeout
+              << "s attr_timeout=" << FLAGS_attr_timeout
+              << "s negative_timeout=" << FLAGS_negative_timeout << "s "
+              << (FLAGS_kernel_cache ? "kernel_cache"
+                  : FLAGS_auto_cache ? "auto_cache"
+                                     : "no page cache across opens")
+              << std::endl;
+}
+
+void torch_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    Status s = engine(req)->lookup(parent, name, &st);
+    if (s.is_not_found() && FLAGS_negative_timeout > 0) {
+        // An entry with inode 0 makes the kernel cache the missing name
+        struct fuse_entry_param e;
+        memset(&e, 0, sizeof(e));
+        e.entry_timeout = FLAGS_negative_timeout;
+        fuse_reply_entry(req, &e);
+        return;
+    }
     if (!s.ok()) {
-        std::cerr << "Error reading directory: " << s.ToString() << std::endl;
-        return -errno;
+        if (!s.is_not_found()) {
+            std::cerr << "Error looking up " << name << ": " << s.ToString()
+                      << std::endl;
+        }
+        fuse_reply_err(req, status_to_errno(s));
+        return;
     }
-    return 0;
+    reply_entry(req, st);
 }
 
-// Removed static for external linkage.
-int torch_getattr(const char *path, struct stat *stbuf,
-                  struct fuse_file_info * /*fi*/) {
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    Status s = se->getattr(se->get_logic_path(path), stbuf);
+void torch_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
+    engine(req)->forget(ino, nlookup);
+    fuse_reply_none(req);
+}
 
-    if (s.is_not_found()) {
-        std::cerr << "File or Directory not found: " << path << std::endl;
-        return -ENOENT;
-    } else if (s.is_invalid_argument()) {
-        std::cerr << "Invalid argument: " << s.ToString() << std::endl;
-        return -EINVAL;
-    } else if (s.is_io_error()) {
-        std::cerr << "IO error: " << s.ToString() << std::endl;
-        return -EIO;
-    } else if (!s.ok()) {
+void torch_forget_multi(fuse_req_t req, size_t count,
+                        struct fuse_forget_data *forgets) {
+    for (size_t i = 0; i < count; i++) {
+        engine(req)->forget(forgets[i].ino, forgets[i].nlookup);
+    }
+    fuse_reply_none(req);
+}
+
+void torch_getattr(fuse_req_t req, fuse_ino_t ino,
+                   struct fuse_file_info * /*fi*/) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    Status s = engine(req)->getattr(ino, &st);
+    if (!s.ok()) {
         std::cerr << "Error getting attributes: " << s.ToString() << std::endl;
-        return -errno;
+        fuse_reply_err(req, status_to_errno(s));
+        return;
+    }
+    fuse_reply_attr(req, &st, FLAGS_attr_timeout);
+}
+
+void torch_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                   int to_set, struct fuse_file_info * /*fi*/) {
+    // Only timestamps can be changed, like with the utimens-only high-level
+    // operations before
+    const int times = FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME |
+                      FUSE_SET_ATTR_ATIME_NOW | FUSE_SET_ATTR_MTIME_NOW;
+    if (to_set & ~(times | FUSE_SET_ATTR_CTIME)) {
+        fuse_reply_err(req, ENOSYS);
+        return;
     }
 
-    return 0;
+    StorageEngine *se = engine(req);
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    Status s = se->getattr(ino, &st);
+    if (s.ok() && (to_set & times)) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        struct timespec tv[2] = {st.st_atim, st.st_mtim};
+        if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+            tv[0] = now;
+        } else if (to_set & FUSE_SET_ATTR_ATIME) {
+            tv[0] = attr->st_atim;
+        }
+        if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+            tv[1] = now;
+        } else if (to_set & FUSE_SET_ATTR_MTIME) {
+            tv[1] = attr->st_mtim;
+        }
+        s = se->utimens(ino, tv);
+        if (s.ok()) {
+            s = se->getattr(ino, &st);
+        }
+    }
+    if (!s.ok()) {
+        std::cerr << "Error updating times: " << s.ToString() << std::endl;
+        fuse_reply_err(req, status_to_errno(s));
+        return;
+    }
+    fuse_reply_attr(req, &st, FLAGS_attr_timeout);
+}
+
+void torch_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    DirCursor *cursor = nullptr;
+    Status s = engine(req)->opendir(ino, &cursor);
+    if (!s.ok()) {
+        fuse_reply_err(req, status_to_errno(s));
+        return;
+    }
+    fi->fh = reinterpret_cast<uint64_t>(cursor);
+    fuse_reply_open(req, fi);
+}
+
+// Fills one reply of a directory stream, the offset of an entry being its
+// position in the stream plus one
+static void fill_dir(fuse_req_t req, size_t size, off_t off,
+                     struct fuse_file_info *fi, bool plus) {
+    auto cursor = reinterpret_cast<DirCursor *>(fi->fh);
+
+    std::vector<char> buf(size);
+    size_t used = 0;
+    Status s = engine(req)->readdir(
+        cursor, off, plus, [&](const DirEntry &entry, off_t next) {
+            size_t entsize;
+            if (plus) {
+                struct fuse_entry_param e;
+                memset(&e, 0, sizeof(e));
+                e.attr = entry.attr;
+                // The kernel doesn't look up entries with inode 0, which
+                // keeps it from counting references to "." and ".."
+                if (entry.name != "." && entry.name != "..") {
+                    e.ino = entry.inode;
+                    e.attr_timeout = FLAGS_attr_timeout;
+                    e.entry_timeout = FLAGS_entry_timeout;
+                }
+                entsize =
+                    fuse_add_direntry_plus(req, buf.data() + used, size - used,
+                                           entry.name.c_str(), &e, next);
+            } else {
+                entsize = fuse_add_direntry(req, buf.data() + used, size - used,
+                                            entry.name.c_str(), &entry.attr,
+                                            next);
+            }
+            if (entsize > size - used) {
+                return false;
+            }
+            used += entsize;
+            return true;
+        });
+    if (!s.ok()) {
+        std::cerr << "Error reading directory: " << s.ToString() << std::endl;
+        // Entries already filled in may have been counted as lookups, so
+        // the kernel has to get them; the error comes with the next reply
+        if (used == 0) {
+            fuse_reply_err(req, status_to_errno(s));
+            return;
+        }
+    }
+    fuse_reply_buf(req, buf.data(), used);
+}
+
+void torch_readdir(fuse_req_t req, fuse_ino_t /*ino*/, size_t size, off_t off,
+                   struct fuse_file_info *fi) {
+    fill_dir(req, size, off, fi, false);
+}
+
+void torch_readdirplus(fuse_req_t req, fuse_ino_t /*ino*/, size_t size,
+                       off_t off, struct fuse_file_info *fi) {
+    fill_dir(req, size, off, fi, true);
+}
+
+void torch_releasedir(fuse_req_t req, fuse_ino_t /*ino*/,
+                      struct fuse_file_info *fi) {
+    engine(req)->releasedir(reinterpret_cast<DirCursor *>(fi->fh));
+    fi->fh = 0;
+    fuse_reply_err(req, 0);
 }
 
-int torch_access(const char * /*path*/, int /*mask*/) {
+void torch_access(fuse_req_t req, fuse_ino_t /*ino*/, int /*mask*/) {
     // INFO: We don't have a permission system in place
     // so we allow everyone
-    return 0;
+    fuse_reply_err(req, 0);
 }
 
-// Removed static for external linkage.
-int torch_unlink(const char *path) {
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    Status s = se->unlink(se->get_logic_path(path));
-    if (s.is_not_found()) {
-        std::cerr << "File not found: " << path << std::endl;
-        return -ENOENT;
-    } else if (s.is_invalid_argument()) {
-        std::cerr << "Invalid argument: " << s.ToString() << std::endl;
-        return -EINVAL;
-    } else if (s.is_io_error()) {
-        std::cerr << "IO error: " << s.ToString() << std::endl;
-        return -EIO;
-    } else if (!s.ok()) {
+void torch_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    Status s = engine(req)->unlink(parent, name);
+    if (!s.ok()) {
         std::cerr << "Error unlinking file: " << s.ToString() << std::endl;
-        return -errno;
     }
-    return 0;
+    fuse_reply_err(req, s.ok() ? 0 : status_to_errno(s));
 }
 
-// Removed static for external linkage.
-int torch_mkdir(const char *path, mode_t /*mode*/) {
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    Status s = se->mkdir(se->get_logic_path(path));
+void torch_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
+                 mode_t /*mode*/) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    Status s = engine(req)->mkdir(parent, name, &st);
     if (!s.ok()) {
         std::cerr << "Error creating directory: " << s.ToString() << std::endl;
-        return -errno;
+        fuse_reply_err(req, status_to_errno(s));
+        return;
     }
-    return 0;
+    reply_entry(req, st);
 }
 
-// Removed static for external linkage.
-int torch_rmdir(const char *path) {
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    Status s = se->rmdir(se->get_logic_path(path));
+void torch_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    Status s = engine(req)->rmdir(parent, name);
     if (!s.ok()) {
         std::cerr << "Error removing directory: " << s.ToString() << std::endl;
-        return -errno;
     }
-    return 0;
+    fuse_reply_err(req, s.ok() ? 0 : status_to_errno(s));
 }
 
-// Removed static for external linkage.
-int torch_rename(const char *from, const char *to, unsigned int /*flags*/) {
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-
-    std::string logic_from = se->get_logic_path(from);
-    std::string logic_to = se->get_logic_path(to);
-    Status s = se->rename(logic_from, logic_to);
+void torch_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                  fuse_ino_t newparent, const char *newname,
+                  unsigned int /*flags*/) {
+    Status s = engine(req)->rename(parent, name, newparent, newname);
     if (!s.ok()) {
         std::cerr << "Error renaming file: " << s.ToString() << std::endl;
-        return -errno;
     }
-    return 0;
+    fuse_reply_err(req, s.ok() ? 0 : status_to_errno(s));
 }
 
-// Removed static for external linkage.
-int torch_create(const char *path, mode_t /*mode*/, struct fuse_file_info *fi) {
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-
+void torch_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+                  mode_t /*mode*/, struct fuse_file_info *fi) {
     FilePointer *fp = nullptr;
-    Status s = se->create(se->get_logic_path(path));
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    Status s = engine(req)->create(parent, name, open_flags(fi->flags),
+                                   &fp, &st);
     if (!s.ok()) {
         std::cerr << "Error creating file: " << s.ToString() << std::endl;
-        return -errno;
-    }
-
-    s = se->open(se->get_logic_path(path), fi->flags, &fp);
-    if (!s.ok()) {
-        std::cerr << "Error opening file: " << s.ToString() << std::endl;
-        return -errno;
+        fuse_reply_err(req, status_to_errno(s));
+        return;
     }
 
     fi->fh = reinterpret_cast<uint64_t>(fp);
 
-    return 0;
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.ino = st.st_ino;
+    e.attr = st;
+    e.attr_timeout = FLAGS_attr_timeout;
+    e.entry_timeout = FLAGS_entry_timeout;
+    fuse_reply_create(req, &e, fi);
 }
 
-int torch_open(const char *path, struct fuse_file_info *fi) {
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
+void torch_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
     FilePointer *fp = nullptr;
-    Status s = se->open(se->get_logic_path(path), fi->flags, &fp);
+    bool unchanged = false;
+    Status s = engine(req)->open(ino, open_flags(fi->flags), &fp,
+                                 &unchanged);
     if (!s.ok()) {
         std::cerr << "Error opening file: " << s.ToString() << std::endl;
-        return -errno;
-    }
-
-    if (fi == NULL) {
-        std::cerr << "File info is null for path: " << path << std::endl;
-        return -EINVAL; // Invalid argument
+        fuse_reply_err(req, status_to_errno(s));
+        return;
     }
 
     fi->fh = reinterpret_cast<uint64_t>(fp);
-
-    return 0;
+    fi->keep_cache = FLAGS_kernel_cache || (FLAGS_auto_cache && unchanged);
+    fuse_reply_open(req, fi);
 }
 
-// Removed static for external linkage.
-int torch_read(const char *path, char *buf, size_t size, off_t offset,
-               struct fuse_file_info *fi) {
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    std::string logic_path = se->get_logic_path(path);
-
-    FilePointer *fp;
-	if(fi == NULL) {
-        se->open(logic_path, fi->flags, &fp);
-    } else {
-        fp = reinterpret_cast<FilePointer *>(fi->fh);
-    }
+void torch_read(fuse_req_t req, fuse_ino_t /*ino*/, size_t size, off_t off,
+                struct fuse_file_info *fi) {
+    auto fp = reinterpret_cast<FilePointer *>(fi->fh);
 
-    Slice result(buf, size, false);
-    Status s = se->read(fp, result, size, offset);
+    // The reply points at the local cache file, libfuse reads or splices
+    // the data from there
+    struct fuse_bufvec buf = FUSE_BUFVEC_INIT(size);
+    Status s = engine(req)->read_buf(fp, size, off, &buf);
     if (!s.ok()) {
         std::cerr << "Error reading file: " << s.ToString() << std::endl;
-        return -errno;
+        fuse_reply_err(req, status_to_errno(s));
+        return;
     }
 
-    if (fi == NULL)
-        se->close(fp);
-
-    return result.size();
+    fuse_reply_data(req, &buf,
+                    FLAGS_splice ? FUSE_BUF_SPLICE_MOVE : FUSE_BUF_NO_SPLICE);
 }
 
-// Removed static for external linkage.
-int torch_write(const char *path, const char *buf, size_t size, off_t offset,
-                struct fuse_file_info *fi) {
-
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    std::string logic_path = se->get_logic_path(path);
-
-    FilePointer *fp;
-	if(fi == NULL) {
-        se->open(logic_path, fi->flags, &fp);
-    } else {
-        fp = reinterpret_cast<FilePointer *>(fi->fh);
-    }
+void torch_write_buf(fuse_req_t req, fuse_ino_t /*ino*/,
+                     struct fuse_bufvec *bufv, off_t off,
+                     struct fuse_file_info *fi) {
+    auto fp = reinterpret_cast<FilePointer *>(fi->fh);
 
-    Slice data(buf, size, false);
-    Status s = se->write(fp, data, size, offset);
+    size_t written = 0;
+    Status s = engine(req)->write_buf(fp, bufv, off, &written);
     if (!s.ok()) {
         std::cerr << "Error writing file: " << s.ToString() << std::endl;
-        return -errno;
+        fuse_reply_err(req, status_to_errno(s));
+        return;
     }
 
-    if (fi == NULL)
-        se->close(fp);
-
-    return size;
+    fuse_reply_write(req, written);
 }
 
-// Removed static for external linkage.
-int torch_release(const char *path, struct fuse_file_info *fi) {
+void torch_release(fuse_req_t req, fuse_ino_t /*ino*/,
+                   struct fuse_file_info *fi) {
+    auto fp = reinterpret_cast<FilePointer *>(fi->fh);
 
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    std::string logic_path = se->get_logic_path(path);
-
-    FilePointer *fp;
-    fp = reinterpret_cast<FilePointer *>(fi->fh);
-
-    // Check if file is open
-    Status status = se->close(fp);
-    if (!status.ok()) {
-        std::cerr << status.ToString() << std::endl;
-        return -errno;
+    Status s = engine(req)->close(fp);
+    if (!s.ok()) {
+        std::cerr << s.ToString() << std::endl;
     }
-
     fi->fh = 0; // Reset file handle
 
-    return 0;
+    fuse_reply_err(req, s.ok() ? 0 : status_to_errno(s));
 }
 
-// Removed static for external linkage.
-int torch_fsync(const char *path, int /*isdatasync*/,
-                struct fuse_file_info *fi) {
-    (void)fi;
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    std::string logic_path = se->get_logic_path(path);
-    Status s = se->sync(logic_path);
+void torch_flush(fuse_req_t req, fuse_ino_t ino,
+                 struct fuse_file_info * /*fi*/) {
+    // close() reports the errors of writes the kernel cached
+    Status s = engine(req)->sync(ino);
     if (!s.ok()) {
-        std::cerr << "Error syncing file: " << s.ToString() << std::endl;
-        return -errno;
+        std::cerr << "Error flushing file: " << s.ToString() << std::endl;
     }
-
-    return 0;
+    fuse_reply_err(req, s.ok() ? 0 : status_to_errno(s));
 }
 
-int torch_utimens(const char *path, const struct timespec tv[2],
-                  struct fuse_file_info *fi) {
-    (void)fi;
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    std::string logic_path = se->get_logic_path(path);
-    Status s = se->utimens(logic_path, tv);
+void torch_fsync(fuse_req_t req, fuse_ino_t ino, int /*datasync*/,
+                 struct fuse_file_info * /*fi*/) {
+    Status s = engine(req)->sync(ino);
     if (!s.ok()) {
-        std::cerr << "Error updating times: " << s.ToString() << std::endl;
-        return -errno;
+        std::cerr << "Error syncing file: " << s.ToString() << std::endl;
     }
-
-    return 0;
+    fuse_reply_err(req, s.ok() ? 0 : status_to_errno(s));
 }
 
-off_t torch_lseek(const char *path, off_t offset, int whence,
-                struct fuse_file_info *fi) {
-    auto se = static_cast<StorageEngine *>(fuse_get_context()->private_data);
-    std::string logic_path = se->get_logic_path(path);
-
-    FilePointer *fp;
-	if(fi == NULL) {
-        se->open(logic_path, fi->flags, &fp);
-    } else {
-        fp = reinterpret_cast<FilePointer *>(fi->fh);
-    }
+#if FUSE_MINOR_VERSION >= 8
+void torch_lseek(fuse_req_t req, fuse_ino_t /*ino*/, off_t off, int whence,
+                 struct fuse_file_info *fi) {
+    auto fp = reinterpret_cast<FilePointer *>(fi->fh);
 
     off_t new_offset;
-    Status s = se->lseek(fp, offset, whence, &new_offset);
+    Status s = engine(req)->lseek(fp, off, whence, &new_offset);
+    if (!s.ok()) {
+        fuse_reply_err(req, ENXIO);
+        return;
+    }
+    fuse_reply_lseek(req, new_offset);
+}
+#endif
+
+void torch_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                    const char *value, size_t size, int /*flags*/) {
+    Status s = engine(req)->setxattr(ino, name, std::string(value, size));
+    if (s.is_invalid_argument()) {
+        std::cerr << "Invalid extended attribute: " << s.ToString()
+                  << std::endl;
+    } else if (!s.ok() && !s.is_not_found()) {
+        std::cerr << "Error setting extended attribute: " << s.ToString()
+                  << std::endl;
+    }
+    fuse_reply_err(req, s.ok() ? 0 : status_to_errno(s));
+}
 
-    if (fi == NULL)
-        se->close(fp);
+void torch_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                    size_t size) {
+    std::string result;
+    Status s = engine(req)->getxattr(ino, name, &result);
+    if (s.is_not_found()) {
+        fuse_reply_err(req, ENODATA);
+        return;
+    } else if (!s.ok()) {
+        std::cerr << "Error getting extended attribute: " << s.ToString()
+                  << std::endl;
+        fuse_reply_err(req, EIO);
+        return;
+    }
 
-    return new_offset;
-}
\ No newline at end of file
+    // A zero size asks for the length only
+    if (size == 0) {
+        fuse_reply_xattr(req, result.size());
+    } else if (size < result.size()) {
+        fuse_reply_err(req, ERANGE);
+    } else {
+        fuse_reply_buf(req, result.data(), result.size());
+    }
+}
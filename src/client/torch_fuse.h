@@ -1,75 +1,104 @@
 #ifndef TORCH_FUSE_H
 #define TORCH_FUSE_H
 
-#include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-// Removed static for external linkage.
-int torch_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                  off_t offset, struct fuse_file_info *fi,
-                  fuse_readdir_flags flags);
-int torch_getattr(const char *path, struct stat *stbuf,
-                  struct fuse_file_info *fi);
-int torch_access(const char *path, int mask);
-int torch_unlink(const char *path);
-int torch_mkdir(const char *path, mode_t mode);
-int torch_rmdir(const char *path);
-int torch_rename(const char *from, const char *to, unsigned int flags);
-int torch_create(const char *path, mode_t mode, struct fuse_file_info *fi);
-int torch_open(const char *path, struct fuse_file_info *fi);
-int torch_read(const char *path, char *buf, size_t size, off_t offset,
-               struct fuse_file_info *fi);
-int torch_write(const char *path, const char *buf, size_t size, off_t offset,
+// Low-level FUSE front end. Requests carry FUSE inode numbers, which are
+// TorchFS inodes, so they go straight to the StorageEngine inode table
+// without resolving paths.
+void torch_init(void *userdata, struct fuse_conn_info *conn);
+void torch_lookup(fuse_req_t req, fuse_ino_t parent, const char *name);
+void torch_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup);
+void torch_forget_multi(fuse_req_t req, size_t count,
+                        struct fuse_forget_data *forgets);
+void torch_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+void torch_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                   int to_set, struct fuse_file_info *fi);
+void torch_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+void torch_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                   struct fuse_file_info *fi);
+void torch_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size,
+                       off_t off, struct fuse_file_info *fi);
+void torch_releasedir(fuse_req_t req, fuse_ino_t ino,
+                      struct fuse_file_info *fi);
+void torch_access(fuse_req_t req, fuse_ino_t ino, int mask);
+void torch_unlink(fuse_req_t req, fuse_ino_t parent, const char *name);
+void torch_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
+                 mode_t mode);
+void torch_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name);
+void torch_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                  fuse_ino_t newparent, const char *newname,
+                  unsigned int flags);
+void torch_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+                  mode_t mode, struct fuse_file_info *fi);
+void torch_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+void torch_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
                 struct fuse_file_info *fi);
-int torch_release(const char *path, struct fuse_file_info *fi);
-int torch_fsync(const char *path, int isdatasync, struct fuse_file_info *fi);
-int torch_utimens(const char *path, const struct timespec tv[2],
-                  struct fuse_file_info *fi);
-off_t torch_lseek(const char *path, off_t offset, int whence,
-                  struct fuse_file_info *fi);
+void torch_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
+                     off_t off, struct fuse_file_info *fi);
+void torch_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+void torch_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+void torch_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                 struct fuse_file_info *fi);
+// lseek requests only exist since FUSE 3.8
+#if FUSE_MINOR_VERSION >= 8
+void torch_lseek(fuse_req_t req, fuse_ino_t ino, off_t off, int whence,
+                 struct fuse_file_info *fi);
+#endif
+void torch_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                    const char *value, size_t size, int flags);
+void torch_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                    size_t size);
 
-static const struct fuse_operations torch_oper = {.getattr = torch_getattr,
-                                                  .readlink = NULL,
-                                                  .mknod = NULL,
-                                                  .mkdir = torch_mkdir,
-                                                  .unlink = torch_unlink,
-                                                  .rmdir = torch_rmdir,
-                                                  .symlink = NULL,
-                                                  .rename = torch_rename,
-                                                  .link = NULL,
-                                                  .chmod = NULL,
-                                                  .chown = NULL,
-                                                  .truncate = NULL,
-                                                  .open = torch_open,
-                                                  .read = torch_read,
-                                                  .write = torch_write,
-                                                  .statfs = NULL,
-                                                  .flush = NULL,
-                                                  .release = torch_release,
-                                                  .fsync = torch_fsync,
-                                                  .setxattr = NULL,
-                                                  .getxattr = NULL,
-                                                  .listxattr = NULL,
-                                                  .removexattr = NULL,
-                                                  .opendir = NULL,
-                                                  .readdir = torch_readdir,
-                                                  .releasedir = NULL,
-                                                  .fsyncdir = NULL,
-                                                  .init = NULL,
-                                                  .destroy = NULL,
-                                                  .access = torch_access,
-                                                  .create = torch_create,
-                                                  .lock = NULL,
-                                                  .utimens = torch_utimens,
-                                                  .bmap = NULL,
-                                                  .ioctl = NULL,
-                                                  .poll = NULL,
-                                                  .write_buf = NULL,
-                                                  .read_buf = NULL,
-                                                  .flock = NULL,
-                                                  .fallocate = NULL,
-                                                  .copy_file_range = NULL,
-                                                  .lseek = torch_lseek};
-#endif // TORCH_FUSE_H
\ No newline at end of file
+static const struct fuse_lowlevel_ops torch_oper = {
+    .init = torch_init,
+    .destroy = NULL,
+    .lookup = torch_lookup,
+    .forget = torch_forget,
+    .getattr = torch_getattr,
+    .setattr = torch_setattr,
+    .readlink = NULL,
+    .mknod = NULL,
+    .mkdir = torch_mkdir,
+    .unlink = torch_unlink,
+    .rmdir = torch_rmdir,
+    .symlink = NULL,
+    .rename = torch_rename,
+    .link = NULL,
+    .open = torch_open,
+    .read = torch_read,
+    .write = NULL,
+    .flush = torch_flush,
+    .release = torch_release,
+    .fsync = torch_fsync,
+    .opendir = torch_opendir,
+    .readdir = torch_readdir,
+    .releasedir = torch_releasedir,
+    .fsyncdir = NULL,
+    .statfs = NULL,
+    .setxattr = torch_setxattr,
+    .getxattr = torch_getxattr,
+    .listxattr = NULL,
+    .removexattr = NULL,
+    .access = torch_access,
+    .create = torch_create,
+    .getlk = NULL,
+    .setlk = NULL,
+    .bmap = NULL,
+    .ioctl = NULL,
+    .poll = NULL,
+    .write_buf = torch_write_buf,
+    .retrieve_reply = NULL,
+    .forget_multi = torch_forget_multi,
+    .flock = NULL,
+    .fallocate = NULL,
+    .readdirplus = torch_readdirplus,
+    .copy_file_range = NULL,
+#if FUSE_MINOR_VERSION >= 8
+    .lseek = torch_lseek,
+#endif
+};
+#endif // TORCH_FUSE_H
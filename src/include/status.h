@@ -15,6 +15,7 @@ class Status {
         kInvalidArgument,
         kIOError,
         kInternalError,
+        kNotEmpty,
         // Extend with additional error codes as needed.
     };
 
@@ -38,6 +39,7 @@ class Status {
     bool is_invalid_argument() const { return code_ == kInvalidArgument; }
     bool is_io_error() const { return code_ == kIOError; }
     bool is_internal_error() const { return code_ == kInternalError; }
+    bool is_not_empty() const { return code_ == kNotEmpty; }
 
     // Returns a human-readable string representation of this status.
     std::string ToString() const {
@@ -69,6 +71,9 @@ class Status {
     static Status InternalError(const std::string &msg) {
         return Status(kInternalError, msg);
     }
+    static Status NotEmpty(const std::string &msg) {
+        return Status(kNotEmpty, msg);
+    }
 
     // Comparison operators.
     bool operator==(const Status &other) const {
@@ -97,6 +102,8 @@ class Status {
             return "IOError";
         case kInternalError:
             return "InternalError";
+        case kNotEmpty:
+            return "NotEmpty";
         default:
             return "UnknownError";
         }
@@ -20,6 +20,9 @@ DEFINE_string(path, "", "Path to metadata storage");
 DEFINE_string(host, "127.0.1.1", "Host address for the metadata service");
 
 int main(int argc, char *argv[]) {
+    // Leaders only hand out read indexes under a lease, see read_index().
+    // Set before parsing so the command line can still turn it off.
+    gflags::SetCommandLineOption("raft_enable_leader_lease", "true");
     gflags::ParseCommandLineFlags(&argc, &argv, true);
 
     // Remove gflags initialization.
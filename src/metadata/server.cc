@@ -1,36 +1,94 @@
 #include "server.h"
+#include <cerrno>
 #include <iostream>
 
+// Reads are answered once this peer caught up with what the leader had
+// committed when they arrived, so followers can serve them too. Fails the
+// RPC with EAGAIN otherwise, the client then asks the leader.
+static bool readable(MetadataStateMachine *state_machine,
+                     google::protobuf::RpcController *cntl,
+                     google::protobuf::Closure *done) {
+    Status s = state_machine->wait_readable();
+    if (s.ok()) {
+        return true;
+    }
+    brpc::ClosureGuard done_guard(done);
+    static_cast<brpc::Controller *>(cntl)->SetFailed(EAGAIN, "%s",
+                                                     s.ToString().c_str());
+    return false;
+}
+
 // RPC method implementations
 void MetadataServiceImpl::open(google::protobuf::RpcController *cntl,
                                const InodeRequest *request, FileInfo *response,
                                google::protobuf::Closure *done) {
-    (void)cntl;
     std::cout << "[open] Request received for inode: " << request->inode()
               << std::endl;
+    if (!readable(state_machine_, cntl, done)) {
+        return;
+    }
     state_machine_->open(request, response, done);
 }
 
+void MetadataServiceImpl::getchunks(google::protobuf::RpcController *cntl,
+                                    const ChunksRequest *request,
+                                    ChunksLocation *response,
+                                    google::protobuf::Closure *done) {
+    (void)cntl;
+    std::cout << "[getchunks] Request received for inode: "
+              << request->inode() << std::endl;
+    state_machine_->getchunks(request, response, done);
+}
+
 void MetadataServiceImpl::getattr(google::protobuf::RpcController *cntl,
                                   const InodeRequest *request,
                                   Attributes *response,
                                   google::protobuf::Closure *done) {
-    (void)cntl;
     std::cout << "[getattr] Request received for inode: " << request->inode()
               << std::endl;
+    if (!readable(state_machine_, cntl, done)) {
+        return;
+    }
     state_machine_->getattr(request, response, done);
 }
 
+void MetadataServiceImpl::lookup(google::protobuf::RpcController *cntl,
+                                 const LookupRequest *request,
+                                 Attributes *response,
+                                 google::protobuf::Closure *done) {
+    if (!readable(state_machine_, cntl, done)) {
+        return;
+    }
+    brpc::ClosureGuard done_guard(done);
+    Status s = state_machine_->lookup(request, response);
+    if (!s.ok()) {
+        static_cast<brpc::Controller *>(cntl)->SetFailed(
+            s.is_not_found() ? ENOENT : EIO, "%s", s.ToString().c_str());
+    }
+}
+
 void MetadataServiceImpl::readdir(google::protobuf::RpcController *cntl,
                                   const ReadDirRequest *request,
                                   ReadDirResponse *response,
                                   google::protobuf::Closure *done) {
-    (void)cntl;
     std::cout << "[readdir] Request received for inode: " << request->inode()
               << std::endl;
+    if (!readable(state_machine_, cntl, done)) {
+        return;
+    }
     state_machine_->readdir(request, response, done);
 }
 
+void MetadataServiceImpl::readdirplus(google::protobuf::RpcController *cntl,
+                                      const ReadDirPlusRequest *request,
+                                      ReadDirPlusResponse *response,
+                                      google::protobuf::Closure *done) {
+    if (!readable(state_machine_, cntl, done)) {
+        return;
+    }
+    state_machine_->readdirplus(request, response, done);
+}
+
 void MetadataServiceImpl::setattr(google::protobuf::RpcController *cntl,
                                   const Attributes *request,
                                   Attributes *response,
@@ -102,3 +160,56 @@ void MetadataServiceImpl::renamedir(google::protobuf::RpcController *cntl,
     std::cout << "[renamedir] Request received for inode: " << std::endl;
     state_machine_->renamedir(request, response, done);
 }
+
+void MetadataServiceImpl::registernode(google::protobuf::RpcController *cntl,
+                                       const StorageNodeInfo *request,
+                                       google::protobuf::Empty *response,
+                                       google::protobuf::Closure *done) {
+    (void)cntl;
+    std::cout << "[registernode] Request received for node: "
+              << request->name() << " at " << request->address() << std::endl;
+    state_machine_->registernode(request, response, done);
+}
+
+void MetadataServiceImpl::heartbeat(google::protobuf::RpcController *cntl,
+                                    const StorageNodeInfo *request,
+                                    google::protobuf::Empty *response,
+                                    google::protobuf::Closure *done) {
+    (void)response;
+    brpc::ClosureGuard done_guard(done);
+    Status s = state_machine_->heartbeat(request);
+    if (!s.ok()) {
+        // The storage node registers again on ENOENT
+        static_cast<brpc::Controller *>(cntl)->SetFailed(
+            s.is_not_found() ? ENOENT : EPERM, "%s", s.ToString().c_str());
+    }
+}
+
+void MetadataServiceImpl::getnodemap(google::protobuf::RpcController *cntl,
+                                     const google::protobuf::Empty *request,
+                                     NodeMap *response,
+                                     google::protobuf::Closure *done) {
+    (void)request;
+    brpc::ClosureGuard done_guard(done);
+    Status s = state_machine_->node_map(response);
+    if (!s.ok()) {
+        static_cast<brpc::Controller *>(cntl)->SetFailed(
+            EPERM, "%s", s.ToString().c_str());
+    }
+}
+
+void MetadataServiceImpl::readindex(google::protobuf::RpcController *cntl,
+                                    const google::protobuf::Empty *request,
+                                    ReadIndexResponse *response,
+                                    google::protobuf::Closure *done) {
+    (void)request;
+    brpc::ClosureGuard done_guard(done);
+    int64_t index = 0;
+    Status s = state_machine_->read_index(&index);
+    if (!s.ok()) {
+        static_cast<brpc::Controller *>(cntl)->SetFailed(
+            EPERM, "%s", s.ToString().c_str());
+        return;
+    }
+    response->set_index(index);
+}
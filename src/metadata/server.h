@@ -13,9 +13,16 @@ class MetadataServiceImpl : public MetadataService {
     void getattr(::google::protobuf::RpcController *cntl,
                  const ::InodeRequest *request, ::Attributes *response,
                  ::google::protobuf::Closure *done);
+    void lookup(google::protobuf::RpcController *cntl,
+                const LookupRequest *request, Attributes *response,
+                google::protobuf::Closure *done);
     void readdir(google::protobuf::RpcController *cntl,
                  const ReadDirRequest *request, ReadDirResponse *response,
                  google::protobuf::Closure *done);
+    void readdirplus(google::protobuf::RpcController *cntl,
+                     const ReadDirPlusRequest *request,
+                     ReadDirPlusResponse *response,
+                     google::protobuf::Closure *done);
     void createfile(google::protobuf::RpcController *cntl,
                     const CreateRequest *request, Attributes *response,
                     google::protobuf::Closure *done);
@@ -44,6 +51,24 @@ class MetadataServiceImpl : public MetadataService {
     void open(::google::protobuf::RpcController *cntl,
               const ::InodeRequest *request, ::FileInfo *response,
               ::google::protobuf::Closure *done);
+    void getchunks(::google::protobuf::RpcController *cntl,
+                   const ::ChunksRequest *request, ::ChunksLocation *response,
+                   ::google::protobuf::Closure *done);
+    void registernode(::google::protobuf::RpcController *cntl,
+                      const ::StorageNodeInfo *request,
+                      ::google::protobuf::Empty *response,
+                      ::google::protobuf::Closure *done);
+    void heartbeat(::google::protobuf::RpcController *cntl,
+                   const ::StorageNodeInfo *request,
+                   ::google::protobuf::Empty *response,
+                   ::google::protobuf::Closure *done);
+    void getnodemap(::google::protobuf::RpcController *cntl,
+                    const ::google::protobuf::Empty *request,
+                    ::NodeMap *response, ::google::protobuf::Closure *done);
+    void readindex(::google::protobuf::RpcController *cntl,
+                   const ::google::protobuf::Empty *request,
+                   ::ReadIndexResponse *response,
+                   ::google::protobuf::Closure *done);
 
   private:
     MetadataStateMachine
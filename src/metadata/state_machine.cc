@@ -5,21 +5,54 @@
 #include <braft/raft.h>
 #include <braft/storage.h>
 #include <braft/util.h>
+#include <brpc/channel.h>
 #include <brpc/controller.h>
 #include <brpc/server.h>
 #include <butil/at_exit.h>
+#include <butil/time.h>
+#include <gflags/gflags.h>
+#include <google/protobuf/empty.pb.h>
+#include <algorithm>
+#include <filesystem>
 #include <iostream>
 #include <memory>
 
+DEFINE_int32(node_dead_timeout_ms, 10000,
+             "Storage nodes that miss heartbeats for this long are dead");
+DEFINE_uint32(node_overload_inflight, 64,
+              "Storage nodes serving more requests than this are only used "
+              "for new files when there is nothing better");
+DEFINE_uint32(node_full_percent, 95,
+              "Storage nodes this full are only used for new files when there "
+              "is nothing better");
+DEFINE_uint32(readdir_max_entries, 4096,
+              "Maximum number of entries in one page of a directory listing");
+DEFINE_int32(snapshot_interval_s, 3600,
+             "Seconds between Raft snapshots, which let the log be "
+             "truncated; 0 disables them");
+DEFINE_int32(read_index_timeout_ms, 1000,
+             "How long a read waits for the leader's read index and for this "
+             "peer to apply up to it");
+
+// Number of entries in a page of a listing a client asked for at most
+// max_entries of, 0 meaning no preference
+static uint32_t page_size(uint32_t max_entries) {
+    if (max_entries == 0 || max_entries > FLAGS_readdir_max_entries) {
+        return FLAGS_readdir_max_entries;
+    }
+    return max_entries;
+}
+
 // Reimplemented OperationClosure with proper getters.
 class OperationClosure : public braft::Closure {
   public:
     OperationClosure(MetadataStateMachine *sm, OpType op_type,
                      const google::protobuf::Message *request,
                      google::protobuf::Message *response,
-                     google::protobuf::Closure *done)
+                     google::protobuf::Closure *done,
+                     std::unique_ptr<google::protobuf::Message> owned_request)
         : sm_(sm), op_type_(op_type), request_(request), response_(response),
-          done_(done) {}
+          done_(done), owned_request_(std::move(owned_request)) {}
 
     void Run() override {
         std::unique_ptr<OperationClosure> self_guard(this);
@@ -39,22 +72,29 @@ class OperationClosure : public braft::Closure {
     const google::protobuf::Message *request_;
     google::protobuf::Message *response_;
     google::protobuf::Closure *done_;
+    // A request built here rather than received from brpc
+    std::unique_ptr<google::protobuf::Message> owned_request_;
 };
 
 int MetadataStateMachine::start(int port, const std::string &conf,
                                 const std::string &path) {
     // 1. Local storage initialization.
-    storage_ = std::make_unique<MetadataStorage>(join_paths(path, "db"));
+    db_path_ = join_paths(path, "db");
+    storage_ = std::make_unique<MetadataStorage>(db_path_);
     if (auto st = storage_->init(); !st.ok()) {
         LOG(ERROR) << st.ToString();
         return -1;
     }
-    LOG(INFO) << "[KVStore] storage initialised";
+    db_applied_index_ = storage_->applied_index();
+    applied_index_.store(db_applied_index_, butil::memory_order_release);
+    LOG(INFO) << "[KVStore] storage initialised, applied up to index "
+              << db_applied_index_;
 
     // 2. Raft options setup.
     butil::EndPoint self_ep(butil::my_ip(), port);
     braft::NodeOptions opts;
     opts.election_timeout_ms = 5000;
+    opts.snapshot_interval_s = FLAGS_snapshot_interval_s;
     opts.fsm = this;
     opts.node_owns_fsm = false;
 
@@ -93,12 +133,75 @@ void MetadataStateMachine::join() {
     }
 }
 
-void MetadataStateMachine::on_snapshot_save(braft::SnapshotWriter * /*writer*/,
+// The snapshot is a RocksDB checkpoint of the whole DB in the "db"
+// directory of the snapshot
+static const char kSnapshotDb[] = "db";
+
+void MetadataStateMachine::on_snapshot_save(braft::SnapshotWriter *writer,
                                             braft::Closure *done) {
     braft::AsyncClosureGuard guard(done);
+    const std::string dir = join_paths(writer->get_path(), kSnapshotDb);
+    // Entries are applied on this same thread, so the checkpoint holds
+    // exactly the ones up to the snapshot's index
+    Status s = storage_->checkpoint(dir);
+    if (!s.ok()) {
+        LOG(ERROR) << "Failed to save snapshot: " << s.ToString();
+        done->status().set_error(EIO, "%s", s.ToString().c_str());
+        return;
+    }
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+        const std::string file =
+            join_paths(kSnapshotDb, entry.path().filename().string());
+        if (writer->add_file(file) != 0) {
+            done->status().set_error(EIO, "Failed to add %s to the snapshot",
+                                     file.c_str());
+            return;
+        }
+    }
+    if (ec) {
+        done->status().set_error(EIO, "Failed to list %s: %s", dir.c_str(),
+                                 ec.message().c_str());
+    }
 }
 
-int MetadataStateMachine::on_snapshot_load(braft::SnapshotReader * /*reader*/) {
+int MetadataStateMachine::on_snapshot_load(braft::SnapshotReader *reader) {
+    if (is_leader()) {
+        LOG(ERROR) << "Leader is not supposed to load a snapshot";
+        return -1;
+    }
+    braft::SnapshotMeta meta;
+    if (reader->load_meta(&meta) != 0) {
+        LOG(ERROR) << "Failed to load snapshot meta";
+        return -1;
+    }
+    // A DB at or past the snapshot only needs the entries after it, and
+    // on_apply skips the ones it already has
+    const int64_t index = meta.last_included_index();
+    if (db_applied_index_ >= index) {
+        LOG(INFO) << "DB already applied up to " << db_applied_index_
+                  << ", keeping it over the snapshot at index " << index;
+        return 0;
+    }
+    const std::string dir = join_paths(reader->get_path(), kSnapshotDb);
+
+    std::unique_lock<std::shared_mutex> lock(storage_mu_);
+    storage_.reset(); // closes the DB
+    Status s = MetadataStorage::restore(dir, db_path_);
+    if (!s.ok()) {
+        LOG(ERROR) << "Failed to restore snapshot: " << s.ToString();
+        return -1;
+    }
+    storage_ = std::make_unique<MetadataStorage>(db_path_);
+    if (s = storage_->init(); !s.ok()) {
+        LOG(ERROR) << "Failed to open restored DB: " << s.ToString();
+        return -1;
+    }
+    db_applied_index_ = storage_->applied_index();
+    lock.unlock();
+
+    set_applied_index(db_applied_index_);
+    LOG(INFO) << "Loaded snapshot at index " << index;
     return 0;
 }
 
@@ -107,6 +210,11 @@ bool MetadataStateMachine::is_leader() const {
 }
 
 void MetadataStateMachine::on_leader_start(int64_t term) {
+    {
+        std::lock_guard<std::mutex> lock(nodes_mu_);
+        node_stats_.clear();
+        leader_since_ms_ = butil::monotonic_time_ms();
+    }
     leader_term_.store(term, butil::memory_order_release);
     LOG(INFO) << "Node becomes leader";
 }
@@ -116,10 +224,100 @@ void MetadataStateMachine::on_leader_stop(const butil::Status &status) {
     LOG(INFO) << "Node stepped down : " << status;
 }
 
+// Configuration entries never reach on_apply, and every new leader commits
+// one before it starts, so they have to move the applied index too or
+// reads would wait for the next write
+void MetadataStateMachine::on_configuration_committed(
+    const braft::Configuration &conf, int64_t index) {
+    LOG(INFO) << "Configuration " << conf << " committed at index " << index;
+    set_applied_index(index);
+}
+
+Status MetadataStateMachine::read_index(int64_t *index) {
+    if (!is_leader()) {
+        return Status::IOError("Not the leader");
+    }
+    // Without a valid lease a newer leader may already accept writes
+    if (!node_->is_leader_lease_valid()) {
+        return Status::IOError("Leader lease not valid");
+    }
+    braft::NodeStatus status;
+    node_->get_status(&status);
+    *index = status.committed_index;
+    return Status::OK();
+}
+
+Status MetadataStateMachine::fetch_read_index(int64_t *index) {
+    braft::PeerId leader = node_->leader_id();
+    if (leader.is_empty()) {
+        return Status::IOError("No leader");
+    }
+    std::shared_ptr<brpc::Channel> channel;
+    {
+        std::lock_guard<std::mutex> lock(leader_mu_);
+        if (!leader_channel_ || leader_addr_ != leader.addr) {
+            auto fresh = std::make_shared<brpc::Channel>();
+            if (fresh->Init(leader.addr, nullptr) != 0) {
+                return Status::IOError("Failed to connect to the leader");
+            }
+            leader_channel_ = std::move(fresh);
+            leader_addr_ = leader.addr;
+        }
+        channel = leader_channel_;
+    }
+
+    brpc::Controller cntl;
+    cntl.set_timeout_ms(FLAGS_read_index_timeout_ms);
+    google::protobuf::Empty req;
+    ReadIndexResponse resp;
+    MetadataService_Stub stub(channel.get());
+    stub.readindex(&cntl, &req, &resp, nullptr);
+    if (cntl.Failed()) {
+        return Status::IOError("readindex to " + leader.to_string() +
+                               " failed: " + cntl.ErrorText());
+    }
+    *index = resp.index();
+    return Status::OK();
+}
+
+Status MetadataStateMachine::wait_readable() {
+    int64_t index = 0;
+    Status s = is_leader() ? read_index(&index) : fetch_read_index(&index);
+    if (!s.ok()) {
+        return s;
+    }
+    if (applied_index_.load(butil::memory_order_acquire) >= index) {
+        return Status::OK();
+    }
+
+    int64_t deadline_us =
+        butil::monotonic_time_us() + FLAGS_read_index_timeout_ms * 1000L;
+    std::unique_lock<bthread::Mutex> lock(applied_mu_);
+    while (applied_index_.load(butil::memory_order_acquire) < index) {
+        int64_t left_us = deadline_us - butil::monotonic_time_us();
+        if (left_us <= 0) {
+            return Status::IOError("Timed out applying up to read index " +
+                                   std::to_string(index));
+        }
+        applied_cv_.wait_for(lock, left_us);
+    }
+    return Status::OK();
+}
+
+void MetadataStateMachine::set_applied_index(int64_t index) {
+    std::lock_guard<bthread::Mutex> lock(applied_mu_);
+    if (index <= applied_index_.load(butil::memory_order_relaxed)) {
+        return;
+    }
+    applied_index_.store(index, butil::memory_order_release);
+    applied_cv_.notify_all();
+}
+
 Status MetadataStateMachine::open(const InodeRequest *request,
                                   FileInfo *response,
                                   google::protobuf::Closure *done) {
     brpc::ClosureGuard done_guard(done);
+    std::shared_lock<std::shared_mutex> lock(storage_mu_);
     auto [s, info] = storage_->open(request->inode());
     if (!s.ok()) {
         return s;
@@ -128,10 +326,24 @@ Status MetadataStateMachine::open(const InodeRequest *request,
     return Status::OK();
 }
 
+Status MetadataStateMachine::getchunks(const ChunksRequest *request,
+                                       ChunksLocation *response,
+                                       google::protobuf::Closure *done) {
+    brpc::ClosureGuard done_guard(done);
+    std::shared_lock<std::shared_mutex> lock(storage_mu_);
+    auto [s, location] = storage_->get_chunks(request->inode());
+    if (!s.ok()) {
+        return s;
+    }
+    response->CopyFrom(location);
+    return Status::OK();
+}
+
 Status MetadataStateMachine::getattr(const InodeRequest *request,
                                      Attributes *response,
                                      google::protobuf::Closure *done) {
     brpc::ClosureGuard done_guard(done);
+    std::shared_lock<std::shared_mutex> lock(storage_mu_);
     auto [s, attr] = storage_->getattr(request->inode());
     if (!s.ok()) {
         return s;
@@ -140,11 +352,26 @@ Status MetadataStateMachine::getattr(const InodeRequest *request,
     return Status::OK();
 }
 
+Status MetadataStateMachine::lookup(const LookupRequest *request,
+                                    Attributes *response) {
+    std::shared_lock<std::shared_mutex> lock(storage_mu_);
+    auto [s, attr] = storage_->lookup(request->p_inode(), request->name());
+    if (!s.ok()) {
+        return s;
+    }
+    response->Swap(&attr);
+    return Status::OK();
+}
+
 Status MetadataStateMachine::readdir(const ReadDirRequest *request,
                                      ReadDirResponse *response,
                                      google::protobuf::Closure *done) {
     brpc::ClosureGuard done_guard(done);
-    auto [s, entries] = storage_->readdir(request->inode());
+    std::shared_lock<std::shared_mutex> lock(storage_mu_);
+    bool more = false;
+    auto [s, entries] =
+        storage_->readdir(request->inode(), request->start_after(),
+                          page_size(request->max_entries()), &more);
     if (!s.ok()) {
         return s;
     }
@@ -153,19 +380,70 @@ Status MetadataStateMachine::readdir(const ReadDirRequest *request,
         dirent->set_inode(entry.inode());
         dirent->set_name(entry.name());
     }
+    response->set_more(more);
+    return Status::OK();
+}
+
+Status MetadataStateMachine::readdirplus(const ReadDirPlusRequest *request,
+                                         ReadDirPlusResponse *response,
+                                         google::protobuf::Closure *done) {
+    brpc::ClosureGuard done_guard(done);
+    std::shared_lock<std::shared_mutex> lock(storage_mu_);
+    bool more = false;
+    auto [s, entries] =
+        storage_->readdirplus(request->inode(), request->start_after(),
+                              page_size(request->max_entries()), &more);
+    if (!s.ok()) {
+        return s;
+    }
+    for (auto &entry : entries) {
+        response->add_entries()->Swap(&entry);
+    }
+    response->set_more(more);
     return Status::OK();
 }
 
 Status MetadataStateMachine::setattr(const ::Attributes *request,
                                      ::Attributes *response,
                                      google::protobuf::Closure *done) {
-    return apply_operation(request, response, done, OP_SETATTR);
+    // A file placed again is ranked by the leader, like in createfile
+    std::string key;
+    bool placing = false;
+    if (is_leader()) {
+        std::shared_lock<std::shared_mutex> lock(storage_mu_);
+        placing = storage_->needs_placement(request->inode(), *request, &key);
+    }
+    if (!placing) {
+        return apply_operation(request, response, done, OP_SETATTR);
+    }
+    auto placed = std::make_unique<Attributes>(*request);
+    placed->clear_placement();
+    for (const auto &node : live_placement(key)) {
+        placed->add_placement(node);
+    }
+    const Attributes *placed_request = placed.get();
+    return apply_operation(placed_request, response, done, OP_SETATTR,
+                           std::move(placed));
 }
 
 Status MetadataStateMachine::createfile(const CreateRequest *request,
                                         Attributes *response,
                                         google::protobuf::Closure *done) {
-    return apply_operation(request, response, done, OP_CREATEFILE);
+    // Only the leader knows which storage nodes are alive, so it ranks them
+    // here and the ranking is replicated with a copy of the request, which
+    // the closure keeps until done runs.
+    if (!is_leader()) {
+        return apply_operation(request, response, done, OP_CREATEFILE);
+    }
+    auto placed = std::make_unique<CreateRequest>(*request);
+    placed->clear_placement();
+    for (const auto &node : live_placement(MetadataStorage::placement_key(
+             request->p_inode(), request->name()))) {
+        placed->add_placement(node);
+    }
+    const CreateRequest *placed_request = placed.get();
+    return apply_operation(placed_request, response, done, OP_CREATEFILE,
+                           std::move(placed));
 }
 
 Status MetadataStateMachine::createdir(const CreateRequest *request,
@@ -198,13 +476,132 @@ Status MetadataStateMachine::renamedir(const RenameRequest *request,
     return apply_operation(request, response, done, OP_RENAMEDIR);
 }
 
+Status MetadataStateMachine::registernode(const StorageNodeInfo *request,
+                                          google::protobuf::Empty *response,
+                                          google::protobuf::Closure *done) {
+    if (is_leader()) {
+        record_heartbeat(*request);
+    }
+    return apply_operation(request, response, done, OP_REGISTERNODE);
+}
+
+Status MetadataStateMachine::heartbeat(const StorageNodeInfo *request) {
+    if (!is_leader()) {
+        return Status::IOError("Not the leader");
+    }
+    std::shared_lock<std::shared_mutex> lock(storage_mu_);
+    auto [s, map] = storage_->node_map();
+    if (!s.ok()) {
+        return s;
+    }
+    for (const auto &node : map.nodes()) {
+        if (node.name() == request->name()) {
+            if (node.address() != request->address()) {
+                return Status::NotFound("Node moved, register again");
+            }
+            record_heartbeat(*request);
+            return Status::OK();
+        }
+    }
+    return Status::NotFound("Node not registered");
+}
+
+Status MetadataStateMachine::node_map(NodeMap *response) {
+    if (!is_leader()) {
+        return Status::IOError("Not the leader");
+    }
+    std::shared_lock<std::shared_mutex> storage_lock(storage_mu_);
+    auto [s, map] = storage_->node_map();
+    storage_lock.unlock();
+    if (!s.ok()) {
+        return s;
+    }
+
+    int64_t now = butil::monotonic_time_ms();
+    std::lock_guard<std::mutex> lock(nodes_mu_);
+    for (auto &node : *map.mutable_nodes()) {
+        auto it = node_stats_.find(node.name());
+        if (it != node_stats_.end()) {
+            const StorageNodeInfo &stats = it->second.info;
+            node.set_capacity(stats.capacity());
+            node.set_used(stats.used());
+            node.set_inflight(stats.inflight());
+            node.set_latency_us(stats.latency_us());
+        }
+        node.set_alive(node_alive(node.name(), now));
+    }
+    response->Swap(&map);
+    return Status::OK();
+}
+
+void MetadataStateMachine::record_heartbeat(const StorageNodeInfo &info) {
+    std::lock_guard<std::mutex> lock(nodes_mu_);
+    NodeStats &stats = node_stats_[info.name()];
+    stats.info = info;
+    stats.last_heartbeat_ms = butil::monotonic_time_ms();
+}
+
+// Called with nodes_mu_ held
+bool MetadataStateMachine::node_alive(const std::string &name,
+                                      int64_t now_ms) {
+    auto it = node_stats_.find(name);
+    if (it == node_stats_.end()) {
+        // A new leader gives every node one timeout to check in
+        return now_ms - leader_since_ms_ < FLAGS_node_dead_timeout_ms;
+    }
+    return now_ms - it->second.last_heartbeat_ms < FLAGS_node_dead_timeout_ms;
+}
+
+// Called with nodes_mu_ held
+bool MetadataStateMachine::node_overloaded(const std::string &name) {
+    auto it = node_stats_.find(name);
+    if (it == node_stats_.end()) {
+        return false;
+    }
+    const StorageNodeInfo &info = it->second.info;
+    if (info.inflight() > FLAGS_node_overload_inflight) {
+        return true;
+    }
+    return info.capacity() > 0 &&
+           info.used() * 100 >= info.capacity() * FLAGS_node_full_percent;
+}
+
+std::vector<std::string>
+MetadataStateMachine::live_placement(const std::string &key) {
+    std::vector<std::string> nodes;
+    {
+        std::shared_lock<std::shared_mutex> lock(storage_mu_);
+        nodes = storage_->rank_nodes(key);
+    }
+
+    // Keep the hash order within each class: healthy nodes first, then
+    // overloaded ones, dead ones last
+    int64_t now = butil::monotonic_time_ms();
+    std::lock_guard<std::mutex> lock(nodes_mu_);
+    std::vector<std::string> healthy, overloaded, dead;
+    for (auto &node : nodes) {
+        if (!node_alive(node, now)) {
+            dead.push_back(std::move(node));
+        } else if (node_overloaded(node)) {
+            overloaded.push_back(std::move(node));
+        } else {
+            healthy.push_back(std::move(node));
+        }
+    }
+    healthy.insert(healthy.end(), overloaded.begin(), overloaded.end());
+    healthy.insert(healthy.end(), dead.begin(), dead.end());
+    return healthy;
+}
+
 // Add this helper function to KVStore (e.g. in the private section of
 // state_machine.h)
 Status
 MetadataStateMachine::apply_operation(const google::protobuf::Message *request,
                                       google::protobuf::Message *response,
                                       google::protobuf::Closure *done,
-                                      OpType op) {
+                                      OpType op,
+                                      std::unique_ptr<google::protobuf::Message>
+                                          owned_request) {
     brpc::ClosureGuard done_guard(done);
     if (!is_leader()) {
         return Status::IOError("Not the leader");
@@ -222,16 +619,29 @@ MetadataStateMachine::apply_operation(const google::protobuf::Message *request,
     }
     braft::Task task;
     task.data = &log;
-    task.done =
-        new OperationClosure(this, op, request, response, done_guard.release());
+    task.done = new OperationClosure(this, op, request, response,
+                                     done_guard.release(),
+                                     std::move(owned_request));
     node_->apply(task);
     return Status::OK();
 }
 
 void MetadataStateMachine::on_apply(braft::Iterator &iter) {
+    // The whole batch of entries goes to the DB in one write, and the
+    // clients get their answers once it is there
+    int64_t last_index = 0;
+    std::vector<braft::Closure *> dones;
+    storage_->begin_batch();
     for (; iter.valid(); iter.next()) {
-        // Ensure closure's Run() is called.
-        braft::AsyncClosureGuard closure_guard(iter.done());
+        last_index = iter.index();
+        if (iter.done()) {
+            dones.push_back(iter.done());
+        }
+        // Entries still in the DB from before a restart are replayed from
+        // the log, applying them again would e.g. create files twice
+        if (iter.index() <= db_applied_index_) {
+            continue;
+        }
         butil::IOBuf data = iter.data();
         OpType op;
 
@@ -266,17 +676,25 @@ void MetadataStateMachine::on_apply(braft::Iterator &iter) {
                     response =
                         dynamic_cast<Attributes *>(closure->get_response());
                 }
+            } else {
+                butil::IOBufAsZeroCopyInputStream wrapper(data);
+                google::protobuf::io::CodedInputStream coded_input(&wrapper);
+                uint32_t dummy;
+                coded_input.ReadVarint32(&dummy);
+                Attributes tmp;
+                CHECK(tmp.ParseFromCodedStream(&coded_input));
+                request = new Attributes(tmp);
             }
             if (request) {
                 LOG(INFO) << "Performing SetAttr operation for inode "
                           << request->inode();
-                Status status = storage_->setattr(request->inode(), *request);
-                // Retrieve the updated attributes and copy to response so that
+                // The attributes stored afterwards go in the response so that
                 // required fields are set.
-                auto [s, updated_attr] = storage_->getattr(request->inode());
-                if (!s.ok()) {
+                auto [status, updated_attr] =
+                    storage_->setattr(request->inode(), *request);
+                if (!status.ok()) {
                     LOG(ERROR)
-                        << "Failed to get updated attributes: " << s.ToString();
+                        << "SetAttr operation failed: " << status.ToString();
                 }
                 if (response) {
                     response->CopyFrom(updated_attr);
@@ -314,8 +732,10 @@ void MetadataStateMachine::on_apply(braft::Iterator &iter) {
             if (request) {
                 LOG(INFO) << "Performing CreateFile operation for inode "
                           << request->p_inode();
-                auto [status, attr] =
-                    storage_->create_file(request->p_inode(), request->name());
+                std::vector<std::string> placement(
+                    request->placement().begin(), request->placement().end());
+                auto [status, attr] = storage_->create_file(
+                    request->p_inode(), request->name(), placement);
                 if (response) {
                     if (status.ok()) {
                         LOG(INFO) << "CreateFile operation succeeded";
@@ -517,9 +937,62 @@ void MetadataStateMachine::on_apply(braft::Iterator &iter) {
             }
             break;
         }
+        case OP_REGISTERNODE: {
+            StorageNodeInfo *request = nullptr;
+            if (iter.done()) {
+                OperationClosure *closure =
+                    dynamic_cast<OperationClosure *>(iter.done());
+                if (closure) {
+                    request =
+                        dynamic_cast<StorageNodeInfo *>(closure->get_request());
+                }
+            } else {
+                butil::IOBufAsZeroCopyInputStream wrapper(data);
+                google::protobuf::io::CodedInputStream coded_input(&wrapper);
+                uint32_t dummy;
+                coded_input.ReadVarint32(&dummy);
+                StorageNodeInfo tmp;
+                CHECK(tmp.ParseFromCodedStream(&coded_input));
+                request = new StorageNodeInfo(tmp);
+            }
+            if (request) {
+                LOG(INFO) << "Performing RegisterNode operation for node "
+                          << request->name();
+                Status status = storage_->register_node(*request);
+                if (!status.ok()) {
+                    LOG(ERROR) << "RegisterNode operation failed: "
+                               << status.ToString();
+                }
+            }
+            if (!iter.done() && request) {
+                delete request;
+            }
+            break;
+        }
         default:
             LOG(WARNING) << "Unknown op type: " << op;
             break;
         }
     }
+
+    if (last_index > db_applied_index_) {
+        Status s = storage_->commit_batch(last_index);
+        if (!s.ok()) {
+            // Going on would record a later applied index over the lost
+            // entries and this replica would diverge, so stop here and let
+            // a restart apply them again from the log
+            LOG(FATAL) << "Failed to commit applied entries up to "
+                       << last_index << ": " << s.ToString();
+        }
+        db_applied_index_ = last_index;
+    } else {
+        storage_->abort_batch();
+    }
+    for (auto *done : dones) {
+        done->Run();
+    }
+    // Reads waiting for this batch can go ahead
+    if (last_index > 0) {
+        set_applied_index(last_index);
+    }
 }
\ No newline at end of file
@@ -8,9 +8,16 @@
 #include <braft/raft.h>          // braft::Node braft::StateMachine
 #include <braft/storage.h>       // braft::SnapshotWriter
 #include <braft/util.h>          // braft::AsyncClosureGuard
+#include <brpc/channel.h>        // brpc::Channel
 #include <brpc/controller.h>     // brpc::Controller
 #include <brpc/server.h>         // brpc::Server
+#include <bthread/condition_variable.h>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
 enum OpType : int32_t {
     OP_SETATTR = 1,
@@ -20,6 +27,7 @@ enum OpType : int32_t {
     OP_REMOVEDIR = 5,
     OP_RENAMEFILE = 6,
     OP_RENAMEDIR = 7,
+    OP_REGISTERNODE = 8,
 };
 
 class MetadataStateMachine : public braft::StateMachine {
@@ -45,10 +53,17 @@ class MetadataStateMachine : public braft::StateMachine {
 
     Status open(const InodeRequest *request, FileInfo *response,
                 google::protobuf::Closure *done);
+    Status getchunks(const ChunksRequest *request, ChunksLocation *response,
+                     google::protobuf::Closure *done);
     Status getattr(const InodeRequest *request, Attributes *response,
                    google::protobuf::Closure *done);
+    // Answered without done, NotFound tells the client the name is free
+    Status lookup(const LookupRequest *request, Attributes *response);
     Status readdir(const ReadDirRequest *request, ReadDirResponse *response,
                    google::protobuf::Closure *done);
+    Status readdirplus(const ReadDirPlusRequest *request,
+                       ReadDirPlusResponse *response,
+                       google::protobuf::Closure *done);
     Status createfile(const ::CreateRequest *request, ::Attributes *response,
                       google::protobuf::Closure *done);
     Status setattr(const ::Attributes *request, ::Attributes *response,
@@ -67,22 +82,77 @@ class MetadataStateMachine : public braft::StateMachine {
     Status renamedir(const RenameRequest *request,
                      google::protobuf::Empty *response,
                      google::protobuf::Closure *done);
+    Status registernode(const StorageNodeInfo *request,
+                        google::protobuf::Empty *response,
+                        google::protobuf::Closure *done);
+
+    // Storage node liveness is soft state of the leader: heartbeats are not
+    // replicated, and a new leader rebuilds it from the next round of them.
+    Status heartbeat(const StorageNodeInfo *request);
+    Status node_map(NodeMap *response);
+
+    // Reads are served by any peer. The leader hands out its commit index
+    // while its lease shows nobody else can have been elected, and a peer
+    // answers a read once it applied up to the index it got for it.
+    Status read_index(int64_t *index);
+    Status wait_readable();
 
     // Implement the StateMachine interface
 
     void on_apply(braft::Iterator &iter) override;
-    Status apply_operation(const google::protobuf::Message *request,
-                           google::protobuf::Message *response,
-                           google::protobuf::Closure *done, OpType op);
+    // owned_request, when given, is request itself, which then lives until
+    // done runs instead of being owned by brpc
+    Status apply_operation(
+        const google::protobuf::Message *request,
+        google::protobuf::Message *response, google::protobuf::Closure *done,
+        OpType op,
+        std::unique_ptr<google::protobuf::Message> owned_request = nullptr);
     void on_snapshot_save(braft::SnapshotWriter *writer,
                           braft::Closure *done) override;
     int on_snapshot_load(braft::SnapshotReader *reader) override;
     bool is_leader() const;
     void on_leader_start(int64_t term) override;
     void on_leader_stop(const butil::Status &status) override;
+    using braft::StateMachine::on_configuration_committed;
+    void on_configuration_committed(const braft::Configuration &conf,
+                                    int64_t index) override;
 
   private:
+    struct NodeStats {
+        StorageNodeInfo info;
+        int64_t last_heartbeat_ms;
+    };
+
+    // Loading a snapshot swaps storage_ for a DB reopened from it. RPCs
+    // reading the DB hold storage_mu_ shared, the Raft state machine
+    // thread that applies entries and loads snapshots doesn't need to.
     std::unique_ptr<MetadataStorage> storage_;
+    std::shared_mutex storage_mu_;
+    std::string db_path_;
+    // Index of the last entry in the DB, on_apply skips the ones up to it
+    int64_t db_applied_index_ = 0;
     braft::Node *volatile node_;
     butil::atomic<int64_t> leader_term_;
+
+    // Index of the last log entry on_apply went through
+    butil::atomic<int64_t> applied_index_{0};
+    bthread::Mutex applied_mu_;
+    bthread::ConditionVariable applied_cv_;
+
+    // Followers ask the leader for read indexes over this channel
+    std::mutex leader_mu_;
+    butil::EndPoint leader_addr_;
+    std::shared_ptr<brpc::Channel> leader_channel_;
+
+    std::mutex nodes_mu_;
+    std::unordered_map<std::string, NodeStats> node_stats_;
+    int64_t leader_since_ms_ = 0;
+
+    Status fetch_read_index(int64_t *index);
+    void set_applied_index(int64_t index);
+
+    void record_heartbeat(const StorageNodeInfo &info);
+    bool node_alive(const std::string &name, int64_t now_ms);
+    bool node_overloaded(const std::string &name);
+    std::vector<std::string> live_placement(const std::string &key);
 };
\ No newline at end of file
@@ -1,14 +1,50 @@
 #include "storage.h"
+#include "rocksdb/utilities/checkpoint.h"
+#include "rocksdb/utilities/write_batch_with_index.h"
 #include <cstdint>
+#include <filesystem>
+#include <gflags/gflags.h>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <algorithm>
 #include <sys/stat.h>
 
+DEFINE_string(storage_nodes, "node1,node2,node3,node4,node5,node6",
+              "Comma-separated storage nodes used until nodes register, and "
+              "for files created before placement was recorded");
+DEFINE_uint32(default_ec_k, 4, "Data fragments per stripe of the root profile");
+DEFINE_uint32(default_ec_m, 2,
+              "Parity fragments per stripe of the root profile");
+DEFINE_uint64(default_stripe_size, 8 * 1024 * 1024,
+              "Stripe unit size, in bytes, given to new files whose profile "
+              "doesn't set one");
+static bool validate_default_stripe_size(const char * /*flag*/,
+                                         uint64_t value) {
+    // Same bounds the clients accept for a profile
+    return value >= 4 * 1024 * 1024 && value <= 16 * 1024 * 1024;
+}
+DEFINE_validator(default_stripe_size, &validate_default_stripe_size);
+DEFINE_string(default_ec_backend, "",
+              "liberasurecode backend of the root profile; empty lets each "
+              "client pick its fastest one when a file is first written");
+DEFINE_bool(apply_wal, false,
+            "Also write applied Raft entries to the RocksDB WAL. The Raft "
+            "log already holds them, and entries the DB lost in a crash are "
+            "applied again from it.");
+
+// Index of the last Raft entry in the DB, in the default CF
+static const char kAppliedIndexKey[] = "_applied_index";
+
 Status MetadataStorage::init() {
     // Set up options.
     rocksdb::Options options;
     options.create_if_missing = true;
     options.create_missing_column_families = true;
+    // Batches span all column families and _applied_index sits in the
+    // default one. Without the WAL only flushed memtables survive a crash,
+    // so they must all flush together to stay at the same applied index.
+    options.atomic_flush = true;
 
     rocksdb::ColumnFamilyOptions cf_options;
     cf_options.comparator = rocksdb::BytewiseComparator();
@@ -23,6 +59,8 @@ Status MetadataStorage::init() {
         rocksdb::ColumnFamilyDescriptor("dentry", cf_options));
     column_families.push_back(
         rocksdb::ColumnFamilyDescriptor("nodes", cf_options));
+    column_families.push_back(
+        rocksdb::ColumnFamilyDescriptor("registry", cf_options));
 
     // Open (or create) the DB.
     std::vector<rocksdb::ColumnFamilyHandle *> handles;
@@ -38,9 +76,11 @@ Status MetadataStorage::init() {
     }
 
     // Map the handles to the corresponding member variables.
+    cf_default_ = handles[0];
     cf_inode_ = handles[1];
     cf_dentry_ = handles[2];
     cf_nodes_ = handles[3];
+    cf_registry_ = handles[4];
 
     // 1) Verify on‐disk column families exactly match what we expect.
     std::vector<std::string> existing_cfs;
@@ -53,7 +93,7 @@ Status MetadataStorage::init() {
     }
     std::set<std::string> seen(existing_cfs.begin(), existing_cfs.end());
     std::set<std::string> want = {rocksdb::kDefaultColumnFamilyName, "inode",
-                                  "dentry", "nodes"};
+                                  "dentry", "nodes", "registry"};
     if (seen != want) {
         std::cerr << "[ERROR] CF mismatch: on-disk:";
         for (auto &n : existing_cfs)
@@ -111,7 +151,163 @@ Status MetadataStorage::init() {
     return Status::OK();
 }
 
+MetadataStorage::~MetadataStorage() {
+    if (db_ == nullptr) {
+        return;
+    }
+    for (auto *cf :
+         {cf_default_, cf_inode_, cf_dentry_, cf_nodes_, cf_registry_}) {
+        if (cf != nullptr) {
+            db_->DestroyColumnFamilyHandle(cf);
+        }
+    }
+    db_->Close();
+    delete db_;
+}
+
+Status MetadataStorage::checkpoint(const std::string &dir) {
+    rocksdb::Checkpoint *raw = nullptr;
+    rocksdb::Status st = rocksdb::Checkpoint::Create(db_, &raw);
+    if (!st.ok()) {
+        return Status::IOError("Failed to create checkpoint: " + st.ToString());
+    }
+    std::unique_ptr<rocksdb::Checkpoint> checkpoint(raw);
+    // Without the WAL, only flushed writes make it into the checkpoint
+    rocksdb::FlushOptions flush_options;
+    flush_options.wait = true;
+    st = db_->Flush(flush_options, {cf_default_, cf_inode_, cf_dentry_,
+                                    cf_nodes_, cf_registry_});
+    if (!st.ok()) {
+        return Status::IOError("Failed to flush before checkpoint: " +
+                               st.ToString());
+    }
+    st = checkpoint->CreateCheckpoint(dir);
+    if (!st.ok()) {
+        return Status::IOError("Failed to write checkpoint to " + dir + ": " +
+                               st.ToString());
+    }
+    return Status::OK();
+}
+
+Status MetadataStorage::restore(const std::string &dir,
+                                const std::string &db_path) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    // Build the new DB next to the old one, so a failure leaves it intact
+    const fs::path tmp = db_path + ".restore";
+    fs::remove_all(tmp, ec);
+    fs::create_directories(tmp, ec);
+    if (ec) {
+        return Status::IOError("Failed to create " + tmp.string() + ": " +
+                               ec.message());
+    }
+    for (const auto &entry : fs::directory_iterator(dir, ec)) {
+        const fs::path to = tmp / entry.path().filename();
+        // Table files are never modified and can be shared with the
+        // snapshot, the DB appends to the others (e.g. the MANIFEST)
+        if (entry.path().extension() == ".sst") {
+            fs::create_hard_link(entry.path(), to, ec);
+        }
+        if (entry.path().extension() != ".sst" || ec) {
+            ec.clear();
+            fs::copy_file(entry.path(), to, ec);
+        }
+        if (ec) {
+            return Status::IOError("Failed to copy " + entry.path().string() +
+                                   ": " + ec.message());
+        }
+    }
+    if (ec) {
+        return Status::IOError("Failed to list " + dir + ": " + ec.message());
+    }
+    fs::remove_all(db_path, ec);
+    if (!ec) {
+        fs::rename(tmp, db_path, ec);
+    }
+    if (ec) {
+        return Status::IOError("Failed to replace " + db_path + ": " +
+                               ec.message());
+    }
+    return Status::OK();
+}
+
+// Makes the writes of one namespace operation atomic: unless commit() is
+// called they are rolled back. Inside an apply batch the operation is a save
+// point of it, otherwise it gets a batch of its own that commit() writes.
+class MetadataStorage::OpBatch {
+  public:
+    explicit OpBatch(MetadataStorage *storage)
+        : storage_(storage), own_(!storage->batch_) {
+        if (own_) {
+            storage_->begin_batch();
+        } else {
+            storage_->batch_->SetSavePoint();
+        }
+    }
+    ~OpBatch() {
+        if (done_) {
+            return;
+        }
+        if (own_) {
+            storage_->abort_batch();
+        } else {
+            storage_->batch_->RollbackToSavePoint();
+        }
+    }
+
+    Status commit() {
+        done_ = true;
+        if (!own_) {
+            storage_->batch_->PopSavePoint();
+            return Status::OK();
+        }
+        std::unique_ptr<rocksdb::WriteBatchWithIndex> batch =
+            std::move(storage_->batch_);
+        rocksdb::Status s = storage_->db_->Write(rocksdb::WriteOptions(),
+                                                 batch->GetWriteBatch());
+        if (!s.ok())
+            return Status::IOError("Write failed: " + s.ToString());
+        return Status::OK();
+    }
+
+  private:
+    MetadataStorage *storage_;
+    bool own_;
+    bool done_ = false;
+};
+
+void MetadataStorage::begin_batch() {
+    batch_ = std::make_unique<rocksdb::WriteBatchWithIndex>(
+        rocksdb::BytewiseComparator(), 0, /*overwrite_key=*/true);
+}
+
+Status MetadataStorage::commit_batch(int64_t applied_index) {
+    std::unique_ptr<rocksdb::WriteBatchWithIndex> batch = std::move(batch_);
+    batch->Put(cf_default_, kAppliedIndexKey, std::to_string(applied_index));
+    rocksdb::WriteOptions wo;
+    wo.disableWAL = !FLAGS_apply_wal;
+    rocksdb::Status s = db_->Write(wo, batch->GetWriteBatch());
+    if (!s.ok())
+        return Status::IOError("commit_batch failed: " + s.ToString());
+    return Status::OK();
+}
+
+void MetadataStorage::abort_batch() { batch_.reset(); }
+
+int64_t MetadataStorage::applied_index() {
+    std::string value;
+    Status s = get(cf_default_, kAppliedIndexKey, value, false);
+    if (!s.ok())
+        return 0;
+    return std::stoll(value);
+}
+
 std::pair<Status, Attributes> MetadataStorage::getattr(const uint64_t &inode) {
+    return getattr(inode, false);
+}
+
+std::pair<Status, Attributes> MetadataStorage::getattr(uint64_t inode,
+                                                       bool batched) {
     std::string value;
     rocksdb::ReadOptions read_options;
     rocksdb::Slice key(std::to_string(inode));
@@ -119,7 +315,7 @@ std::pair<Status, Attributes> MetadataStorage::getattr(const uint64_t &inode) {
         std::cerr << "[ERROR] cf_inode_ is null" << std::endl;
         return {Status::IOError("cf_inode_ is null"), Attributes()};
     }
-    Status s = get_inode(inode, value);
+    Status s = get_inode(inode, value, batched);
     if (!s.ok())
         return {s, Attributes()};
 
@@ -132,10 +328,26 @@ std::pair<Status, Attributes> MetadataStorage::getattr(const uint64_t &inode) {
     return {Status::OK(), attr};
 }
 
+std::pair<Status, Attributes>
+MetadataStorage::lookup(const uint64_t &p_inode, const std::string &name) {
+    std::string value;
+    Status s = get_dirent(p_inode, name, value);
+    if (!s.ok()) {
+        return {s, Attributes()};
+    }
+    Dirent dirent;
+    if (!dirent.ParseFromString(value)) {
+        return {Status::IOError("Failed to deserialize Dirent"), Attributes()};
+    }
+    return getattr(dirent.inode());
+}
+
 std::pair<Status, std::vector<Dirent>>
-MetadataStorage::readdir(const uint64_t &inode) {
+MetadataStorage::readdir(const uint64_t &inode, const std::string &start_after,
+                         uint32_t max_entries, bool *more) {
     const std::string prefix = std::to_string(inode) + ":";
     std::vector<Dirent> dirents;
+    *more = false;
 
     rocksdb::ReadOptions read_options;
     read_options.prefix_same_as_start = true;
@@ -147,11 +359,22 @@ MetadataStorage::readdir(const uint64_t &inode) {
         return {s, {}};
     }
 
+    // Dentry keys sort by name within a directory, so a page resumes by
+    // seeking to the last name of the previous one
     auto it = std::unique_ptr<rocksdb::Iterator>(
         db_->NewIterator(read_options, cf_dentry_));
-    for (it->Seek(prefix); it->Valid(); it->Next()) {
+    it->Seek(prefix + start_after);
+    if (!start_after.empty() && it->Valid() &&
+        it->key().ToString() == prefix + start_after) {
+        it->Next();
+    }
+    for (; it->Valid(); it->Next()) {
         if (!it->key().starts_with(prefix))
             break;
+        if (dirents.size() == max_entries) {
+            *more = true;
+            break;
+        }
         Dirent d;
         if (!d.ParseFromString(it->value().ToString())) {
             return {Status::IOError("Failed to deserialize Dirent"), {}};
@@ -161,6 +384,35 @@ MetadataStorage::readdir(const uint64_t &inode) {
     return {Status::OK(), std::move(dirents)};
 }
 
+std::pair<Status, std::vector<DirentPlus>>
+MetadataStorage::readdirplus(const uint64_t &inode,
+                             const std::string &start_after,
+                             uint32_t max_entries, bool *more) {
+    auto [s, dirents] = readdir(inode, start_after, max_entries, more);
+    if (!s.ok()) {
+        return {s, {}};
+    }
+
+    std::vector<DirentPlus> entries;
+    entries.reserve(dirents.size());
+    for (auto &dirent : dirents) {
+        std::string value;
+        Status as = get_inode(dirent.inode(), value);
+        if (as.is_not_found()) {
+            continue; // Removed since the dentry was read
+        } else if (!as.ok()) {
+            return {as, {}};
+        }
+        DirentPlus d;
+        d.mutable_entry()->Swap(&dirent);
+        if (!d.mutable_attr()->ParseFromString(value)) {
+            return {Status::IOError("Failed to deserialize Attributes"), {}};
+        }
+        entries.push_back(std::move(d));
+    }
+    return {Status::OK(), std::move(entries)};
+}
+
 std::pair<Status, FileInfo> MetadataStorage::open(const uint64_t &inode) {
     std::string value;
     rocksdb::ReadOptions read_options;
@@ -169,17 +421,42 @@ std::pair<Status, FileInfo> MetadataStorage::open(const uint64_t &inode) {
     if (!s.ok())
         return {s, FileInfo()};
 
-    // Deserialize the value into a FileInfo object
+    // The inode record holds the Attributes; the layout is taken from there
+    Attributes attr;
+    if (!attr.ParseFromString(value)) {
+        throw std::runtime_error("Failed to deserialize Attributes");
+    }
+
     FileInfo file_info;
-    if (!file_info.ParseFromString(value)) {
-        throw std::runtime_error("Failed to deserialize FileInfo");
+    file_info.set_inode(attr.inode());
+    if (attr.has_ec_profile()) {
+        *file_info.mutable_ec_profile() = attr.ec_profile();
+    }
+    if (S_ISREG(attr.mode())) {
+        s = get_placement(inode, attr.ec_profile(), &file_info);
+        if (!s.ok())
+            return {s, FileInfo()};
     }
 
     return {Status::OK(), file_info};
 }
 
+std::pair<Status, ChunksLocation>
+MetadataStorage::get_chunks(const uint64_t &inode) {
+    auto [s, info] = open(inode);
+    if (!s.ok())
+        return {s, ChunksLocation()};
+
+    ChunksLocation location;
+    *location.mutable_chunk_nodes() = info.chunk_nodes();
+    *location.mutable_parity_nodes() = info.parity_nodes();
+    return {Status::OK(), location};
+}
+
 std::pair<Status, Attributes>
-MetadataStorage::create_file(const uint64_t &p_inode, const std::string &name) {
+MetadataStorage::create_file(const uint64_t &p_inode, const std::string &name,
+                             const std::vector<std::string> &placement) {
+    OpBatch op(this);
     Attributes attr;
     uint64_t inode = get_and_increment_counter();
     attr.set_inode(inode);
@@ -191,6 +468,8 @@ MetadataStorage::create_file(const uint64_t &p_inode, const std::string &name) {
     attr.set_user_id(0);           // Set the user ID as needed
     attr.set_group_id(0);          // Set the group ID as needed
     attr.set_mode(S_IFREG | 0644); // Set the file mode (e.g., 0644)
+    *attr.mutable_ec_profile() = inherited_ec_profile(p_inode);
+    fill_stripe_size(attr.mutable_ec_profile());
 
     std::string value;
     if (!attr.SerializeToString(&value)) {
@@ -214,13 +493,17 @@ MetadataStorage::create_file(const uint64_t &p_inode, const std::string &name) {
     if (!status.ok())
         return {status, attr};
 
-    // TODO: Also create a new entry in the nodes column family
+    status = place_file(attr.inode(), attr.ec_profile(), placement,
+                        placement_key(p_inode, name));
+    if (!status.ok())
+        return {status, attr};
 
-    return {Status::OK(), attr};
+    return {op.commit(), attr};
 }
 
 std::pair<Status, Attributes>
 MetadataStorage::create_dir(const uint64_t &p_inode, const std::string &name) {
+    OpBatch op(this);
     Attributes attr;
     uint64_t inode = get_and_increment_counter();
     attr.set_inode(inode);
@@ -232,6 +515,7 @@ MetadataStorage::create_dir(const uint64_t &p_inode, const std::string &name) {
     attr.set_user_id(0);           // Set the user ID as needed
     attr.set_group_id(0);          // Set the group ID as needed
     attr.set_mode(S_IFDIR | 0644); // Set the directory mode (e.g., 0755)
+    *attr.mutable_ec_profile() = inherited_ec_profile(p_inode);
 
     std::string value;
     if (!attr.SerializeToString(&value)) {
@@ -257,12 +541,13 @@ MetadataStorage::create_dir(const uint64_t &p_inode, const std::string &name) {
             return {status, attr};
     }
 
-    return {Status::OK(), attr};
+    return {op.commit(), attr};
 }
 
 Status MetadataStorage::remove_file(const uint64_t &p_inode,
                                     const uint64_t &inode,
                                     const std::string &name) {
+    OpBatch op(this);
     // Remove the file from the inode column family
     Status status = delete_inode(inode);
     if (!status.ok())
@@ -273,14 +558,17 @@ Status MetadataStorage::remove_file(const uint64_t &p_inode,
     if (!status.ok())
         return status;
 
-    // TODO: Also remove the file in the nodes column family
+    status = delete_nodes(inode);
+    if (!status.ok())
+        return status;
 
-    return Status::OK();
+    return op.commit();
 }
 
 Status MetadataStorage::remove_dir(const uint64_t &p_inode,
                                    const uint64_t &inode,
                                    const std::string &name) {
+    OpBatch op(this);
     // Remove the directory from the inode column family
     Status status = delete_inode(inode);
     if (!status.ok())
@@ -291,16 +579,16 @@ Status MetadataStorage::remove_dir(const uint64_t &p_inode,
     if (!status.ok())
         return status;
 
-    return Status::OK();
+    return op.commit();
 }
 
 Status MetadataStorage::rename_file(const uint64_t &old_p_inode,
                                     const uint64_t &new_p_inode,
                                     const uint64_t &inode,
                                     const std::string &new_name) {
-
+    OpBatch op(this);
     // go to inode entry and change the name of the file
-    auto [s, attr] = getattr(inode);
+    auto [s, attr] = getattr(inode, true);
     if (!s.ok()) {
         return s;
     }
@@ -329,15 +617,16 @@ Status MetadataStorage::rename_file(const uint64_t &old_p_inode,
     if (!status.ok())
         return status;
 
-    return Status::OK();
+    return op.commit();
 }
 
 Status MetadataStorage::rename_dir(const uint64_t &old_p_inode,
                                    const uint64_t &new_p_inode,
                                    const uint64_t &inode,
                                    const std::string &new_name) {
+    OpBatch op(this);
     // go to inode entry and change the name of the file
-    auto [s, attr] = getattr(inode);
+    auto [s, attr] = getattr(inode, true);
     if (!s.ok()) {
         return s;
     }
@@ -356,30 +645,103 @@ Status MetadataStorage::rename_dir(const uint64_t &old_p_inode,
     status = put_dirent(new_p_inode, new_name, value);
     if (!status.ok())
         return status;
-    return Status::OK();
+    return op.commit();
 }
 
-Status MetadataStorage::setattr(const uint64_t &inode, const Attributes &attr) {
+std::pair<Status, Attributes>
+MetadataStorage::setattr(const uint64_t &inode, const Attributes &attr) {
+    OpBatch op(this);
+    auto [s, old_attr] = getattr(inode, true);
+    if (!s.ok())
+        return {s, Attributes()};
+
+    // Keep the profile when the caller did not send one. Stripes already
+    // written were encoded with the old profile, so a file with data can't
+    // switch to another.
+    Attributes new_attr = attr;
+    new_attr.clear_placement();
+    if (S_ISREG(old_attr.mode()) && new_attr.has_ec_profile() &&
+        new_attr.ec_profile().SerializeAsString() !=
+            old_attr.ec_profile().SerializeAsString())
+        fill_stripe_size(new_attr.mutable_ec_profile());
+    if (!new_attr.has_ec_profile()) {
+        if (old_attr.has_ec_profile())
+            *new_attr.mutable_ec_profile() = old_attr.ec_profile();
+    } else if (S_ISREG(old_attr.mode()) && old_attr.size() > 0 &&
+               new_attr.ec_profile().SerializeAsString() !=
+                   old_attr.ec_profile().SerializeAsString()) {
+        return {Status::InvalidArgument(
+                    "Can't change the EC profile of a non-empty file"),
+                old_attr};
+    }
+
     // Update the file attributes in the inode column family
     std::string value;
-    if (!attr.SerializeToString(&value)) {
-        return Status::IOError("Failed to serialize Attributes");
+    if (!new_attr.SerializeToString(&value)) {
+        return {Status::IOError("Failed to serialize Attributes"), old_attr};
     }
     Status status = put_inode(inode, value);
     if (!status.ok())
-        return status;
+        return {status, old_attr};
 
-    return Status::OK();
+    // An empty file whose k+m changed is placed again, ranked like it was
+    // when created
+    if (replaces_placement(old_attr, new_attr)) {
+        std::vector<std::string> placement(attr.placement().begin(),
+                                           attr.placement().end());
+        status = place_file(inode, new_attr.ec_profile(), placement,
+                            stored_placement_key(inode, true));
+        if (!status.ok())
+            return {status, new_attr};
+    }
+
+    return {op.commit(), new_attr};
+}
+
+bool MetadataStorage::needs_placement(uint64_t inode, const Attributes &attr,
+                                      std::string *key) {
+    auto [s, old_attr] = getattr(inode, false);
+    if (!s.ok() || !replaces_placement(old_attr, attr))
+        return false;
+    *key = stored_placement_key(inode, false);
+    return true;
+}
+
+// Filling in the backend or stripe size keeps the nodes, and so does any
+// change once stripes exist, whether stored or being flushed
+bool MetadataStorage::replaces_placement(const Attributes &old_attr,
+                                         const Attributes &new_attr) {
+    if (!S_ISREG(old_attr.mode()) || !new_attr.has_ec_profile())
+        return false;
+    if (old_attr.size() > 0 || new_attr.size() > 0)
+        return false;
+    return !old_attr.has_ec_profile() ||
+           new_attr.ec_profile().k() != old_attr.ec_profile().k() ||
+           new_attr.ec_profile().m() != old_attr.ec_profile().m();
+}
+
+std::string MetadataStorage::placement_key(uint64_t p_inode,
+                                           const std::string &name) {
+    return std::to_string(p_inode) + "/" + name;
+}
+
+std::string MetadataStorage::stored_placement_key(uint64_t inode,
+                                                  bool batched) {
+    std::string value;
+    FileInfo stored;
+    if (get(cf_nodes_, std::to_string(inode), value, batched).ok() &&
+        stored.ParseFromString(value) && stored.has_placement_key())
+        return stored.placement_key();
+    return std::to_string(inode);
 }
 
 uint64_t MetadataStorage::get_and_increment_counter() {
     // read the current counter, store that value, and increment it
-    rocksdb::ReadOptions read_options;
     std::string value;
-    rocksdb::Slice key("_counter");
-    rocksdb::Status status = db_->Get(read_options, cf_inode_, key, &value);
+    const std::string key = "_counter";
+    Status status = get(cf_inode_, key, value, true);
     if (!status.ok()) {
-        if (status.IsNotFound()) {
+        if (status.is_not_found()) {
             return 0;
         }
         throw std::runtime_error("Failed to get counter: " + status.ToString());
@@ -387,9 +749,7 @@ uint64_t MetadataStorage::get_and_increment_counter() {
     uint64_t counter = std::stoull(value);
     uint64_t new_counter = counter + 1;
     // write the new counter back to the database
-    rocksdb::WriteOptions write_options;
-    status =
-        db_->Put(write_options, cf_inode_, key, std::to_string(new_counter));
+    status = put(cf_inode_, key, std::to_string(new_counter));
     if (!status.ok()) {
         throw std::runtime_error("Failed to increment counter: " +
                                  status.ToString());
@@ -397,63 +757,310 @@ uint64_t MetadataStorage::get_and_increment_counter() {
     return counter;
 }
 
+ECProfile MetadataStorage::inherited_ec_profile(uint64_t p_inode) {
+    if (p_inode != 0) {
+        auto [s, parent] = getattr(p_inode, true);
+        if (s.ok() && parent.has_ec_profile()) {
+            return parent.ec_profile();
+        }
+    }
+    ECProfile profile;
+    profile.set_k(FLAGS_default_ec_k);
+    profile.set_m(FLAGS_default_ec_m);
+    profile.set_stripe_size(FLAGS_default_stripe_size);
+    if (!FLAGS_default_ec_backend.empty())
+        profile.set_backend(FLAGS_default_ec_backend);
+    return profile;
+}
+
+void MetadataStorage::fill_stripe_size(ECProfile *profile) {
+    // Stripe boundaries of a file must not depend on the client reading it
+    if (!profile->has_stripe_size() || profile->stripe_size() == 0)
+        profile->set_stripe_size(FLAGS_default_stripe_size);
+}
+
+// Rendezvous (highest random weight) score of a node for a key. Must give
+// the same result on every replica, so no std::hash.
+static uint64_t placement_score(const std::string &key,
+                                const std::string &node) {
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    for (unsigned char c : key + ":" + node) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    // Final avalanche, FNV alone mixes the trailing bytes poorly
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static std::vector<std::string> configured_storage_nodes() {
+    std::vector<std::string> nodes;
+    size_t pos = 0;
+    while (pos <= FLAGS_storage_nodes.size()) {
+        size_t end = FLAGS_storage_nodes.find(',', pos);
+        if (end == std::string::npos)
+            end = FLAGS_storage_nodes.size();
+        if (end > pos)
+            nodes.push_back(FLAGS_storage_nodes.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return nodes;
+}
+
+std::vector<std::string> MetadataStorage::rank_nodes(const std::string &key) {
+    return rank_nodes(key, false);
+}
+
+std::vector<std::string> MetadataStorage::rank_nodes(const std::string &key,
+                                                     bool batched) {
+    std::vector<std::string> nodes;
+    auto [s, map] = node_map(batched);
+    if (s.ok()) {
+        for (const auto &node : map.nodes()) {
+            nodes.push_back(node.name());
+        }
+    }
+    if (nodes.empty()) {
+        nodes = configured_storage_nodes();
+    }
+
+    std::sort(nodes.begin(), nodes.end(),
+              [&key](const std::string &a, const std::string &b) {
+                  uint64_t sa = placement_score(key, a);
+                  uint64_t sb = placement_score(key, b);
+                  return sa != sb ? sa > sb : a < b;
+              });
+    return nodes;
+}
+
+Status MetadataStorage::place_file(uint64_t inode, const ECProfile &profile,
+                                   const std::vector<std::string> &placement,
+                                   const std::string &key) {
+    size_t k = profile.k();
+    size_t m = profile.m();
+    std::vector<std::string> nodes = placement;
+    if (nodes.size() < k + m) {
+        nodes = rank_nodes(key, true);
+    }
+    if (k + m > nodes.size()) {
+        return Status::InvalidArgument("EC profile needs " +
+                                       std::to_string(k + m) +
+                                       " storage nodes, only " +
+                                       std::to_string(nodes.size()) +
+                                       " available");
+    }
+
+    FileInfo info;
+    info.set_inode(inode);
+    info.set_placement_key(key);
+    for (size_t i = 0; i < k + m; i++) {
+        if (i < k)
+            info.add_chunk_nodes(nodes[i]);
+        else
+            info.add_parity_nodes(nodes[i]);
+    }
+
+    std::string value;
+    if (!info.SerializeToString(&value)) {
+        return Status::IOError("Failed to serialize FileInfo");
+    }
+    return put_nodes(inode, value);
+}
+
+Status MetadataStorage::register_node(const StorageNodeInfo &info) {
+    OpBatch op(this);
+    std::string value;
+    Status s = get(cf_registry_, info.name(), value, true);
+    if (!s.ok() && !s.is_not_found())
+        return s;
+
+    StorageNodeInfo known;
+    if (s.ok() && known.ParseFromString(value) &&
+        known.address() == info.address()) {
+        return Status::OK(); // Restarted node, nothing changed
+    }
+
+    // Only membership is replicated, the load stats go with heartbeats
+    StorageNodeInfo entry;
+    entry.set_name(info.name());
+    entry.set_address(info.address());
+    if (!entry.SerializeToString(&value)) {
+        return Status::IOError("Failed to serialize StorageNodeInfo");
+    }
+
+    auto [vs, version] = node_map_version(true);
+    if (!vs.ok())
+        return vs;
+
+    Status ps = put(cf_registry_, info.name(), value);
+    if (ps.ok())
+        ps = put(cf_default_, "_nodemap_version", std::to_string(version + 1));
+    if (ps.ok())
+        ps = op.commit();
+    if (!ps.ok())
+        return ps;
+    std::cout << "[INFO] Storage node " << info.name() << " registered at "
+              << info.address() << ", node map version " << version + 1
+              << std::endl;
+    return Status::OK();
+}
+
+std::pair<Status, NodeMap> MetadataStorage::node_map() {
+    return node_map(false);
+}
+
+std::pair<Status, NodeMap> MetadataStorage::node_map(bool batched) {
+    NodeMap map;
+    auto [vs, version] = node_map_version(batched);
+    if (!vs.ok())
+        return {vs, map};
+    map.set_version(version);
+
+    std::unique_ptr<rocksdb::Iterator> it(
+        db_->NewIterator(rocksdb::ReadOptions(), cf_registry_));
+    if (batched && batch_) {
+        it.reset(batch_->NewIteratorWithBase(cf_registry_, it.release()));
+    }
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        if (!map.add_nodes()->ParseFromString(it->value().ToString())) {
+            return {Status::IOError("Failed to deserialize StorageNodeInfo"),
+                    NodeMap()};
+        }
+    }
+    if (!it->status().ok())
+        return {Status::IOError("node_map failed: " + it->status().ToString()),
+                NodeMap()};
+    return {Status::OK(), map};
+}
+
+std::pair<Status, uint64_t> MetadataStorage::node_map_version(bool batched) {
+    std::string value;
+    Status s = get(cf_default_, "_nodemap_version", value, batched);
+    if (s.is_not_found())
+        return {Status::OK(), 0};
+    if (!s.ok())
+        return {s, 0};
+    return {Status::OK(), std::stoull(value)};
+}
+
+Status MetadataStorage::get_placement(uint64_t inode, const ECProfile &profile,
+                                      FileInfo *info) {
+    std::string value;
+    Status s = get_nodes(inode, value);
+    if (s.ok()) {
+        FileInfo stored;
+        if (!stored.ParseFromString(value)) {
+            return Status::IOError("Failed to deserialize FileInfo");
+        }
+        *info->mutable_chunk_nodes() = stored.chunk_nodes();
+        *info->mutable_parity_nodes() = stored.parity_nodes();
+        return Status::OK();
+    }
+    if (!s.is_not_found())
+        return s;
+
+    // Files created before placement was recorded live on the first k+m
+    // configured nodes
+    std::vector<std::string> nodes = configured_storage_nodes();
+    size_t k = profile.has_k() ? profile.k() : 4;
+    size_t m = profile.has_m() ? profile.m() : 2;
+    if (k + m > nodes.size()) {
+        return Status::IOError("No placement recorded for inode " +
+                               std::to_string(inode));
+    }
+    for (size_t i = 0; i < k + m; i++) {
+        if (i < k)
+            info->add_chunk_nodes(nodes[i]);
+        else
+            info->add_parity_nodes(nodes[i]);
+    }
+    return Status::OK();
+}
+
 // --------------- new helper implementations ---------------
-Status MetadataStorage::get_inode(uint64_t inode, std::string &value) {
+Status MetadataStorage::get(rocksdb::ColumnFamilyHandle *cf,
+                            const std::string &key, std::string &value,
+                            bool batched) {
     rocksdb::ReadOptions ro;
-    rocksdb::Status s = db_->Get(ro, cf_inode_, std::to_string(inode), &value);
+    rocksdb::Status s =
+        batched && batch_ ? batch_->GetFromBatchAndDB(db_, ro, cf, key, &value)
+                          : db_->Get(ro, cf, key, &value);
     if (s.IsNotFound())
-        return Status::NotFound("inode not found");
+        return Status::NotFound(key + " not found");
+    if (!s.ok())
+        return Status::IOError("get " + key + " failed: " + s.ToString());
+    return Status::OK();
+}
+
+Status MetadataStorage::put(rocksdb::ColumnFamilyHandle *cf,
+                            const std::string &key, const std::string &value) {
+    rocksdb::Status s =
+        batch_ ? batch_->Put(cf, key, value)
+               : db_->Put(rocksdb::WriteOptions(), cf, key, value);
     if (!s.ok())
-        return Status::IOError("get_inode failed: " + s.ToString());
+        return Status::IOError("put " + key + " failed: " + s.ToString());
     return Status::OK();
 }
 
+Status MetadataStorage::del(rocksdb::ColumnFamilyHandle *cf,
+                            const std::string &key) {
+    rocksdb::Status s = batch_ ? batch_->Delete(cf, key)
+                               : db_->Delete(rocksdb::WriteOptions(), cf, key);
+    if (!s.ok())
+        return Status::IOError("delete " + key + " failed: " + s.ToString());
+    return Status::OK();
+}
+
+Status MetadataStorage::get_inode(uint64_t inode, std::string &value,
+                                  bool batched) {
+    Status s = get(cf_inode_, std::to_string(inode), value, batched);
+    if (s.is_not_found())
+        return Status::NotFound("inode not found");
+    return s;
+}
+
 Status MetadataStorage::get_dirent(uint64_t parent_inode,
                                    const std::string &name,
                                    std::string &value) {
-    rocksdb::ReadOptions ro;
     std::string key = std::to_string(parent_inode) + ":" + name;
-    rocksdb::Status s = db_->Get(ro, cf_dentry_, key, &value);
-    if (s.IsNotFound())
+    Status s = get(cf_dentry_, key, value, false);
+    if (s.is_not_found())
         return Status::NotFound("dirent not found");
-    if (!s.ok())
-        return Status::IOError("get_dirent failed: " + s.ToString());
-    return Status::OK();
+    return s;
 }
 
 Status MetadataStorage::put_inode(uint64_t inode, const std::string &value) {
-    rocksdb::WriteOptions wo;
-    rocksdb::Status s = db_->Put(wo, cf_inode_, std::to_string(inode), value);
-    if (!s.ok())
-        return Status::IOError("put_inode failed: " + s.ToString());
-    return Status::OK();
+    return put(cf_inode_, std::to_string(inode), value);
 }
 
 Status MetadataStorage::delete_inode(uint64_t inode) {
-    rocksdb::WriteOptions wo;
-    rocksdb::Status s = db_->Delete(wo, cf_inode_, std::to_string(inode));
-    if (!s.ok())
-        return Status::IOError("delete_inode failed: " + s.ToString());
-    return Status::OK();
+    return del(cf_inode_, std::to_string(inode));
 }
 
 Status MetadataStorage::put_dirent(uint64_t parent_inode,
                                    const std::string &name,
                                    const std::string &value) {
-    rocksdb::WriteOptions wo;
-    std::string key = std::to_string(parent_inode) + ":" + name;
-    rocksdb::Status s = db_->Put(wo, cf_dentry_, key, value);
-    if (!s.ok())
-        return Status::IOError("put_dirent failed: " + s.ToString());
-    return Status::OK();
+    return put(cf_dentry_, std::to_string(parent_inode) + ":" + name, value);
 }
 
 Status MetadataStorage::delete_dirent(uint64_t parent_inode,
                                       const std::string &name) {
-    rocksdb::WriteOptions wo;
-    std::string key = std::to_string(parent_inode) + ":" + name;
-    rocksdb::Status s = db_->Delete(wo, cf_dentry_, key);
-    if (!s.ok())
-        return Status::IOError("delete_dirent failed: " + s.ToString());
-    return Status::OK();
-}
\ No newline at end of file
+    return del(cf_dentry_, std::to_string(parent_inode) + ":" + name);
+}
+
+Status MetadataStorage::get_nodes(uint64_t inode, std::string &value) {
+    Status s = get(cf_nodes_, std::to_string(inode), value, false);
+    if (s.is_not_found())
+        return Status::NotFound("placement not found");
+    return s;
+}
+
+Status MetadataStorage::put_nodes(uint64_t inode, const std::string &value) {
+    return put(cf_nodes_, std::to_string(inode), value);
+}
+
+Status MetadataStorage::delete_nodes(uint64_t inode) {
+    return del(cf_nodes_, std::to_string(inode));
+}
@@ -3,26 +3,57 @@
 #include "metadata.pb.h"
 
 #include "rocksdb/db.h"
+#include "rocksdb/utilities/write_batch_with_index.h"
 #include "status.h"
 #include <cstdint>
+#include <memory>
 #include <vector>
 
-#define EC_K 4
-#define EC_M 2
-
 class MetadataStorage {
   public:
     MetadataStorage(const std::string &db_path) : db_path_(db_path) {}
-    ~MetadataStorage() = default;
+    ~MetadataStorage();
 
     Status init();
 
+    // Writes a consistent copy of the DB to `dir`, which must not exist.
+    // Table files are hard links, so this is cheap.
+    Status checkpoint(const std::string &dir);
+    // Replaces the DB at db_path, which must not be open, with a copy of
+    // the checkpoint in `dir`
+    static Status restore(const std::string &dir, const std::string &db_path);
+
+    // Raft entries are applied in batches. Between begin_batch() and
+    // commit_batch() the mutating methods below write to one batch (and
+    // read their own writes), which is then written at once with the index
+    // of the last entry in it. The read methods only see committed batches.
+    void begin_batch();
+    Status commit_batch(int64_t applied_index);
+    void abort_batch();
+    // Index of the last entry whose writes are in the DB, 0 for none
+    int64_t applied_index();
+
     std::pair<Status, Attributes> getattr(const uint64_t &inode);
-    std::pair<Status, std::vector<Dirent>> readdir(const uint64_t &inode);
+    // Attributes of the entry `name` of directory p_inode
+    std::pair<Status, Attributes> lookup(const uint64_t &p_inode,
+                                         const std::string &name);
+    // A page of the entries of inode, starting after the name start_after.
+    // `more` tells if entries follow.
+    std::pair<Status, std::vector<Dirent>>
+    readdir(const uint64_t &inode, const std::string &start_after,
+            uint32_t max_entries, bool *more);
+    // Same with the attributes of the entries
+    std::pair<Status, std::vector<DirentPlus>>
+    readdirplus(const uint64_t &inode, const std::string &start_after,
+                uint32_t max_entries, bool *more);
     std::pair<Status, FileInfo> open(const uint64_t &inode);
+    std::pair<Status, ChunksLocation> get_chunks(const uint64_t &inode);
 
-    std::pair<Status, Attributes> create_file(const uint64_t &p_inode,
-                                              const std::string &name);
+    // `placement` ranks the storage nodes for the new file, best first. If
+    // it is too short the file is placed with rank_nodes(placement_key()).
+    std::pair<Status, Attributes>
+    create_file(const uint64_t &p_inode, const std::string &name,
+                const std::vector<std::string> &placement);
     std::pair<Status, Attributes> create_dir(const uint64_t &p_inode,
                                              const std::string &name);
 
@@ -36,16 +67,77 @@ class MetadataStorage {
     Status rename_dir(const uint64_t &old_p_inode, const uint64_t &new_p_inode,
                       const uint64_t &inode, const std::string &new_name);
 
-    Status setattr(const uint64_t &inode, const Attributes &attr);
+    // Returns the attributes stored for inode afterwards. An empty file
+    // whose k or m change is placed again with attr.placement().
+    std::pair<Status, Attributes> setattr(const uint64_t &inode,
+                                          const Attributes &attr);
+    // Whether setattr(inode, attr) would place the file again, and with
+    // the nodes ranked for which key
+    bool needs_placement(uint64_t inode, const Attributes &attr,
+                         std::string *key);
+
+    // Key the storage nodes of a new file are ranked with
+    static std::string placement_key(uint64_t p_inode,
+                                     const std::string &name);
+
+    // Storage node registry. Re-registering a node under the same address
+    // keeps the node map version.
+    Status register_node(const StorageNodeInfo &info);
+    std::pair<Status, NodeMap> node_map();
+
+    // Registered storage nodes (or --storage_nodes before any registered)
+    // ordered by their rendezvous hash with `key`. Every replica computes
+    // the same order, and adding a node only moves the keys it wins.
+    std::vector<std::string> rank_nodes(const std::string &key);
 
   private:
-    rocksdb::DB *db_; // RocksDB instance for metadata storage.
-    rocksdb::ColumnFamilyHandle *cf_inode_;
-    rocksdb::ColumnFamilyHandle *cf_dentry_;
-    rocksdb::ColumnFamilyHandle *cf_nodes_;
+    rocksdb::DB *db_ = nullptr; // RocksDB instance for metadata storage.
+    rocksdb::ColumnFamilyHandle *cf_default_ = nullptr;
+    rocksdb::ColumnFamilyHandle *cf_inode_ = nullptr;
+    rocksdb::ColumnFamilyHandle *cf_dentry_ = nullptr;
+    rocksdb::ColumnFamilyHandle *cf_nodes_ = nullptr;
+    rocksdb::ColumnFamilyHandle *cf_registry_ = nullptr;
     std::string db_path_;
 
+    // Writes of the entries being applied, see begin_batch(). Only the
+    // state machine thread applying them uses it.
+    std::unique_ptr<rocksdb::WriteBatchWithIndex> batch_;
+    // Scope of the writes of one mutating method, see storage.cc
+    class OpBatch;
+
+    // Reads with `batched` see the open batch, if any; only the mutating
+    // methods may pass it.
+    Status get(rocksdb::ColumnFamilyHandle *cf, const std::string &key,
+               std::string &value, bool batched);
+    Status put(rocksdb::ColumnFamilyHandle *cf, const std::string &key,
+               const std::string &value);
+    Status del(rocksdb::ColumnFamilyHandle *cf, const std::string &key);
+
+    std::pair<Status, Attributes> getattr(uint64_t inode, bool batched);
+    std::pair<Status, NodeMap> node_map(bool batched);
+    std::vector<std::string> rank_nodes(const std::string &key, bool batched);
+
     uint64_t get_and_increment_counter();
+    std::pair<Status, uint64_t> node_map_version(bool batched);
+
+    // EC profile a new entry of p_inode starts with: the parent's, or the
+    // configured default for the root.
+    ECProfile inherited_ec_profile(uint64_t p_inode);
+    // Gives a file's profile the default stripe size if it has none
+    static void fill_stripe_size(ECProfile *profile);
+
+    // Records the first k+m nodes of `placement` (or of rank_nodes(key)
+    // when it is too short) as the storage nodes of a file in the nodes CF.
+    Status place_file(uint64_t inode, const ECProfile &profile,
+                      const std::vector<std::string> &placement,
+                      const std::string &key);
+    // Key a file was placed with; files placed before it was recorded were
+    // ranked on their inode
+    std::string stored_placement_key(uint64_t inode, bool batched);
+    static bool replaces_placement(const Attributes &old_attr,
+                                   const Attributes &new_attr);
+    Status get_placement(uint64_t inode, const ECProfile &profile,
+                         FileInfo *info);
 
     // Write/delete helpers for inode CF
     Status put_inode(uint64_t inode, const std::string &value);
@@ -56,8 +148,13 @@ class MetadataStorage {
                       const std::string &value);
     Status delete_dirent(uint64_t parent_inode, const std::string &name);
 
+    // Write/delete helpers for nodes CF
+    Status put_nodes(uint64_t inode, const std::string &value);
+    Status delete_nodes(uint64_t inode);
+
     // Read helpers
-    Status get_inode(uint64_t inode, std::string &value);
+    Status get_nodes(uint64_t inode, std::string &value);
+    Status get_inode(uint64_t inode, std::string &value, bool batched = false);
     Status get_dirent(uint64_t parent_inode, const std::string &name,
                       std::string &value);
 };
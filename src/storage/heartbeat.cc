@@ -0,0 +1,123 @@
+#include "heartbeat.h"
+#include <algorithm>
+#include <braft/route_table.h>
+#include <brpc/channel.h>
+#include <brpc/controller.h>
+#include <cerrno>
+#include <chrono>
+#include <gflags/gflags.h>
+#include <iostream>
+#include <google/protobuf/empty.pb.h>
+#include <sys/statvfs.h>
+
+DEFINE_int32(heartbeat_interval_ms, 2000,
+             "Interval between heartbeats to the metadata service");
+
+static const std::string kMetadataGroup = "kv_store";
+static constexpr int kTimeoutMs = 1000;
+
+HeartbeatSender::HeartbeatSender(const StorageServiceImpl *service,
+                                 const std::string &name,
+                                 const std::string &address,
+                                 const std::string &mount_path,
+                                 const std::string &metadata_conf)
+    : service_(service), name_(name), address_(address),
+      mount_path_(mount_path), metadata_conf_(metadata_conf) {}
+
+HeartbeatSender::~HeartbeatSender() { stop(); }
+
+Status HeartbeatSender::start() {
+    if (braft::rtb::update_configuration(kMetadataGroup, metadata_conf_) != 0) {
+        return Status::InvalidArgument("Invalid metadata conf: " +
+                                       metadata_conf_);
+    }
+    thread_ = std::thread(&HeartbeatSender::loop, this);
+    return Status::OK();
+}
+
+void HeartbeatSender::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void HeartbeatSender::loop() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (!stopping_) {
+        bool register_node = !registered_;
+        lock.unlock();
+        int rc = send(register_node);
+        lock.lock();
+
+        if (rc == 0) {
+            if (register_node) {
+                std::cout << "[INFO] Registered as " << name_ << " at "
+                          << address_ << std::endl;
+            }
+            registered_ = true;
+        } else if (rc == ENOENT) {
+            registered_ = false;
+        }
+        cv_.wait_for(lock,
+                     std::chrono::milliseconds(FLAGS_heartbeat_interval_ms),
+                     [this] { return stopping_; });
+    }
+}
+
+int HeartbeatSender::send(bool register_node) {
+    braft::PeerId leader;
+    if (braft::rtb::select_leader(kMetadataGroup, &leader) != 0) {
+        if (!braft::rtb::refresh_leader(kMetadataGroup, kTimeoutMs).ok() ||
+            braft::rtb::select_leader(kMetadataGroup, &leader) != 0) {
+            return EHOSTUNREACH;
+        }
+    }
+
+    brpc::Channel channel;
+    if (channel.Init(leader.addr, nullptr) != 0) {
+        braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
+        return EHOSTUNREACH;
+    }
+    brpc::Controller cntl;
+    cntl.set_timeout_ms(kTimeoutMs);
+    StorageNodeInfo req;
+    fill(&req);
+    google::protobuf::Empty resp;
+
+    MetadataService_Stub stub(&channel);
+    if (register_node) {
+        stub.registernode(&cntl, &req, &resp, nullptr);
+    } else {
+        stub.heartbeat(&cntl, &req, &resp, nullptr);
+    }
+    if (cntl.Failed()) {
+        if (cntl.ErrorCode() != ENOENT) {
+            std::cerr << "[WARN] " << (register_node ? "registernode" : "heartbeat")
+                      << " to " << leader << " failed: " << cntl.ErrorText()
+                      << std::endl;
+            braft::rtb::update_leader(kMetadataGroup, braft::PeerId());
+        }
+        return cntl.ErrorCode();
+    }
+    return 0;
+}
+
+void HeartbeatSender::fill(StorageNodeInfo *info) const {
+    info->set_name(name_);
+    info->set_address(address_);
+
+    struct statvfs vfs;
+    if (::statvfs(mount_path_.c_str(), &vfs) == 0) {
+        uint64_t capacity = static_cast<uint64_t>(vfs.f_blocks) * vfs.f_frsize;
+        uint64_t available = static_cast<uint64_t>(vfs.f_bavail) * vfs.f_frsize;
+        info->set_capacity(capacity);
+        info->set_used(capacity - std::min(capacity, available));
+    }
+    info->set_inflight(service_->inflight());
+    info->set_latency_us(service_->latency_us());
+}
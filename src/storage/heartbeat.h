@@ -0,0 +1,42 @@
+#pragma once
+
+#include "metadata.pb.h"
+#include "server.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Registers the storage node with the metadata service and then keeps
+// sending it heartbeats with the node's capacity and load, from a
+// background thread. Registers again when the leader doesn't know the node,
+// e.g. after its registration was lost or the node changed address.
+class HeartbeatSender {
+ public:
+    HeartbeatSender(const StorageServiceImpl *service, const std::string &name,
+                    const std::string &address, const std::string &mount_path,
+                    const std::string &metadata_conf);
+    ~HeartbeatSender();
+
+    Status start();
+    void stop();
+
+ private:
+    const StorageServiceImpl *service_;
+    std::string name_;
+    std::string address_;
+    std::string mount_path_;
+    std::string metadata_conf_;
+
+    std::thread thread_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    bool registered_ = false;
+
+    void loop();
+    // Sends one registernode or heartbeat RPC to the metadata leader.
+    // Returns the brpc error code, 0 on success.
+    int send(bool register_node);
+    void fill(StorageNodeInfo *info) const;
+};
@@ -1,11 +1,19 @@
 #include "storage.pb.h"
 #include "server.h"
+#include "heartbeat.h"
 #include <gflags/gflags.h>
 #include <brpc/server.h>
 #include <google/protobuf/empty.pb.h>
 
 DEFINE_int32(port, 9000, "Listening port of the storage server");
 DEFINE_string(mount_path, "/home/vagrant/storage", "Directory where data is stored");
+DEFINE_string(node_name, "",
+              "Name the node registers under; defaults to node<port - 9000>, "
+              "the names used before nodes registered");
+DEFINE_string(advertise_host, "127.0.0.1",
+              "Address clients reach this storage node at");
+DEFINE_string(metadata_conf, "127.0.2.1:8000:0,",
+              "Peers of the metadata service to register with");
 
 int main(int argc, char** argv) {
     gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -28,6 +36,20 @@ int main(int argc, char** argv) {
         return -1;
     }
 
+    std::string name = FLAGS_node_name.empty()
+                           ? "node" + std::to_string(FLAGS_port - 9000)
+                           : FLAGS_node_name;
+    std::string address =
+        FLAGS_advertise_host + ":" + std::to_string(FLAGS_port);
+    HeartbeatSender heartbeat(&storage_service, name, address,
+                              FLAGS_mount_path, FLAGS_metadata_conf);
+    Status s = heartbeat.start();
+    if (!s.ok()) {
+        LOG(ERROR) << "Fail to start heartbeats: " << s.ToString();
+        return -1;
+    }
+
     server.RunUntilAskedToQuit();
+    heartbeat.stop();
     return 0;
 }
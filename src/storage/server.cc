@@ -1,6 +1,27 @@
 #include "server.h"
+#include <butil/time.h>
 #include <iostream>
 
+// Counts a request as in flight and records its latency when it is done
+class RequestScope {
+ public:
+    RequestScope(std::atomic<uint32_t> *inflight,
+                 bvar::LatencyRecorder *latency)
+        : inflight_(inflight), latency_(latency),
+          start_us_(butil::monotonic_time_us()) {
+        inflight_->fetch_add(1);
+    }
+    ~RequestScope() {
+        *latency_ << butil::monotonic_time_us() - start_us_;
+        inflight_->fetch_sub(1);
+    }
+
+ private:
+    std::atomic<uint32_t> *inflight_;
+    bvar::LatencyRecorder *latency_;
+    int64_t start_us_;
+};
+
 void StorageServiceImpl::read_chunk(
     ::google::protobuf::RpcController *cntl,
     const ::ReadRequest *request, 
@@ -9,14 +30,19 @@ void StorageServiceImpl::read_chunk(
 ) {
     std::cout << "[readfile] Request received for ID: " << request->chunk_id() << std::endl;
     brpc::ClosureGuard done_guard(done);
+    RequestScope scope(&inflight_, &latency_);
     std::cout << "INSIDE READ CHUNK" << std::endl;
-    auto [st, data] = backend_.read_chunk(request->chunk_id());
+    brpc::Controller *ctrl = static_cast<brpc::Controller *>(cntl);
+    // The payload travels in the response attachment, not in Data
+    auto [st, len] = backend_.read_chunk(request->chunk_id(), request->offset(),
+                                         request->length(),
+                                         &ctrl->response_attachment());
     if (!st.ok()) {
         std::cerr << "Error reading chunk: " << st.ToString() << std::endl;
-        static_cast<brpc::Controller *>(cntl)->SetFailed(st.ToString());
+        ctrl->SetFailed(st.ToString());
         return;
     }
-    *response = data;
+    response->set_len(len);
 }
 
 void StorageServiceImpl::write_chunk(
@@ -28,10 +54,19 @@ void StorageServiceImpl::write_chunk(
     std::cout << "[writefile] Request received for ID: " << request->chunk_id()
               << ", size: " << request->data().len() << std::endl;
     brpc::ClosureGuard done_guard(done);
-    auto [st, bytes_written] = backend_.write_chunk(request->chunk_id(), request->data());
+    RequestScope scope(&inflight_, &latency_);
+    brpc::Controller *ctrl = static_cast<brpc::Controller *>(cntl);
+    butil::IOBuf &payload = ctrl->request_attachment();
+    if (payload.size() != request->data().len()) {
+        ctrl->SetFailed("Attachment size does not match data length");
+        return;
+    }
+    auto [st, bytes_written] =
+        backend_.write_chunk(request->chunk_id(), &payload,
+                             request->offset(), !request->has_offset());
     if (!st.ok()) {
         std::cerr << "Error writing chunk: " << st.ToString() << std::endl;
-        static_cast<brpc::Controller *>(cntl)->SetFailed(st.ToString());
+        ctrl->SetFailed(st.ToString());
         return;
     }
     response->set_bytes_written(bytes_written);
@@ -45,6 +80,7 @@ void StorageServiceImpl::delete_chunk(
 ) {
     std::cout << "[deletefile] Request received for ID: " << request->chunk_id() << std::endl;
     brpc::ClosureGuard done_guard(done);
+    RequestScope scope(&inflight_, &latency_);
     auto st = backend_.remove_chunk(request->chunk_id());
     if (!st.ok()) {
         static_cast<brpc::Controller *>(cntl)->SetFailed(st.ToString());
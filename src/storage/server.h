@@ -1,7 +1,11 @@
+#pragma once
+
 #include "storage.pb.h"
 #include "status.h"
 #include "storage_backend.h"
+#include <atomic>
 #include <brpc/server.h>
+#include <bvar/latency_recorder.h>
 #include <iostream>
 
 class StorageServiceImpl : public StorageService {
@@ -30,6 +34,12 @@ class StorageServiceImpl : public StorageService {
         ::google::protobuf::Closure *done
     );
 
+    // Load reported with heartbeats
+    uint32_t inflight() const { return inflight_.load(); }
+    int64_t latency_us() const { return latency_.latency(); }
+
  private:
     StorageBackend backend_;
+    std::atomic<uint32_t> inflight_{0};
+    bvar::LatencyRecorder latency_;
 };
@@ -11,15 +11,15 @@ std::string StorageBackend::get_chunk_path(const std::string &chunk_id) const {
     return mount_path_ + "/chunk-" + chunk_id;
 }
 
-std::pair<Status, Data>
-StorageBackend::read_chunk(const std::string &chunk_id) {
+std::pair<Status, uint64_t>
+StorageBackend::read_chunk(const std::string &chunk_id, uint64_t offset,
+                           uint64_t length, butil::IOBuf *out) {
     std::string path = get_chunk_path(chunk_id);
-    Data result;
     int fd = ::open(path.c_str(), O_RDONLY);
     if (fd < 0) {
         return {Status::NotFound("Open failed: " + path + " (" +
                                  strerror(errno) + ")"),
-                result};
+                0};
     }
 
     struct stat st;
@@ -27,51 +27,77 @@ StorageBackend::read_chunk(const std::string &chunk_id) {
         ::close(fd);
         return {Status::IOError("fstat failed: " + path + " (" +
                                 strerror(errno) + ")"),
-                result};
+                0};
     }
 
-    size_t filesize = st.st_size;
-    std::string buf(filesize, '\0');
-    ssize_t bytes_read = ::pread(fd, buf.data(), filesize, 0);
-    ::close(fd);
+    uint64_t filesize = st.st_size;
+    if (offset > filesize) {
+        ::close(fd);
+        return {Status::InvalidArgument("Offset past end of chunk: " + path),
+                0};
+    }
+    uint64_t count = filesize - offset;
+    if (length > 0 && length < count) {
+        count = length;
+    }
 
-    if (bytes_read < 0) {
-        return {Status::IOError("Pread failed: " + path + " (" +
-                                strerror(errno) + ")"),
-                result};
+    // Read straight into IOBuf blocks; the portal may need several calls
+    // for a large range.
+    butil::IOPortal portal;
+    uint64_t bytes_read = 0;
+    while (bytes_read < count) {
+        ssize_t n = portal.pappend_from_file_descriptor(
+            fd, offset + bytes_read, count - bytes_read);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            return {Status::IOError("Pread failed: " + path + " (" +
+                                    strerror(errno) + ")"),
+                    0};
+        }
+        if (n == 0) break;
+        bytes_read += n;
     }
+    ::close(fd);
 
     std::cout << "READ " << bytes_read << " bytes from chunk: " << chunk_id
               << std::endl;
-    result.set_payload(buf);
-    result.set_len(static_cast<size_t>(bytes_read));
+    out->append(std::move(portal));
 
-    return {Status::OK(), result};
+    return {Status::OK(), bytes_read};
 }
 
 std::pair<Status, size_t>
-StorageBackend::write_chunk(const std::string &chunk_id, const Data &data) {
+StorageBackend::write_chunk(const std::string &chunk_id, butil::IOBuf *data,
+                            uint64_t offset, bool replace) {
     std::string path = get_chunk_path(chunk_id);
-    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    int flags = O_WRONLY | O_CREAT | (replace ? O_TRUNC : 0);
+    int fd = ::open(path.c_str(), flags, 0644);
     if (fd < 0) {
         return {Status::IOError("Open failed: " + path + " (" +
                                 strerror(errno) + ")"),
                 0};
     }
 
-    ssize_t bytes_written =
-        ::pwrite(fd, data.payload().c_str(), data.len(), 0);
+    // Write the IOBuf blocks out in place, without flattening them first
+    size_t bytes_written = 0;
+    while (!data->empty()) {
+        ssize_t n = data->pcut_into_file_descriptor(fd, offset + bytes_written,
+                                                    data->size());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            return {Status::IOError("Pwrite failed: " + path + " (" +
+                                    strerror(errno) + ")"),
+                    0};
+        }
+        bytes_written += n;
+    }
     ::close(fd);
 
     std::cout << "WROTE bytes: " << bytes_written << std::endl;
 
-    if (bytes_written != static_cast<ssize_t>(data.len())) {
-        return {Status::IOError("Pwrite failed: " + path + " (" +
-                                strerror(errno) + ")"),
-                0};
-    }
-
-    return {Status::OK(), static_cast<size_t>(bytes_written)};
+    return {Status::OK(), bytes_written};
 }
 
 Status StorageBackend::remove_chunk(const std::string &chunk_id) {
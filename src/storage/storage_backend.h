@@ -2,6 +2,7 @@
 
 #include "storage.pb.h"
 #include "status.h"
+#include <butil/iobuf.h>
 #include <cstdint>
 
 class StorageBackend {
@@ -9,8 +10,17 @@ public:
     StorageBackend(const std::string &mount_path);
     ~StorageBackend() = default;
 
-    std::pair<Status, Data> read_chunk(const std::string &chunk_id);
-    std::pair<Status, uint64_t> write_chunk(const std::string &chunk_id, const Data &data);
+    // Appends [offset, offset + length) of the chunk to out; length 0 reads
+    // up to the end of the chunk. Returns the number of bytes read.
+    std::pair<Status, uint64_t> read_chunk(const std::string &chunk_id,
+                                           uint64_t offset, uint64_t length,
+                                           butil::IOBuf *out);
+    // Writes (and consumes) data at offset. With replace set, the chunk is
+    // truncated first so it holds exactly the new data.
+    std::pair<Status, uint64_t> write_chunk(const std::string &chunk_id,
+                                            butil::IOBuf *data,
+                                            uint64_t offset = 0,
+                                            bool replace = true);
     Status remove_chunk(const std::string &chunk_id);
 
 private: